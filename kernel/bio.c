@@ -1,7 +1,8 @@
 // Buffer cache.
 //
 // The buffer cache is a linked list of buf structures holding
-// cached copies of disk block contents.  Caching disk blocks
+// cached copies of disk block contents. It starts with NBUF
+// buffers and grows when all of them are in use.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
@@ -23,9 +24,11 @@
 #include "fs.h"
 #include "buf.h"
 
+static struct buf* newbuf(void);
+
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct kmem_cache *cache; // where bufs come from
 
   // Linked list of all buffers, through prev/next.
   // Sorted by how recently the buffer was used.
@@ -36,20 +39,33 @@ struct {
 void
 binit(void)
 {
-  struct buf *b;
-
   initlock(&bcache.lock, "bcache");
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf));
 
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
+  for(int i = 0; i < NBUF; i++)
+    if(newbuf() == 0)
+      panic("binit");
+}
+
+// Allocate a buffer and put it at the head of the list.
+// Caller must hold bcache.lock, or be binit().
+static struct buf*
+newbuf(void)
+{
+  struct buf *b;
+
+  if((b = kmem_cache_alloc(bcache.cache)) == 0)
+    return 0;
+  memset(b, 0, sizeof(*b) - BSIZE);
+  initsleeplock(&b->lock, "buffer");
+  b->next = bcache.head.next;
+  b->prev = &bcache.head;
+  bcache.head.next->prev = b;
+  bcache.head.next = b;
+  return b;
 }
 
 // Look through buffer cache for block on device dev.
@@ -85,7 +101,23 @@ bget(uint dev, uint blockno)
       return b;
     }
   }
-  panic("bget: no buffers");
+
+  // All in use; grow the cache.
+  if((b = newbuf()) == 0){
+    // out of memory: make room and look again, since the
+    // block may have been cached meanwhile.
+    release(&bcache.lock);
+    if(reclaim(1) == 0)
+      panic("bget: no buffers");
+    return bget(dev, blockno);
+  }
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -136,6 +168,31 @@ brelse(struct buf *b)
   release(&bcache.lock);
 }
 
+// Release a locked buffer whose block isn't likely to be
+// wanted again soon, like file data that has been copied to
+// the page cache: move it to the least-recently-used end,
+// so that it is recycled before metadata blocks.
+void
+bdrop(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bdrop");
+
+  releasesleep(&b->lock);
+
+  acquire(&bcache.lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    b->next = &bcache.head;
+    b->prev = bcache.head.prev;
+    bcache.head.prev->next = b;
+    bcache.head.prev = b;
+  }
+  release(&bcache.lock);
+}
+
 void
 bpin(struct buf *b) {
   acquire(&bcache.lock);
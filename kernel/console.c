@@ -21,6 +21,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "poll.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -50,6 +51,7 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+  struct pollent *pollq;  // poll()s waiting for input
 } cons;
 
 //
@@ -142,6 +144,10 @@ consoleintr(int c)
   switch(c){
   case C('P'):  // Print process list.
     procdump();
+    kmemdump();
+    slabdump();
+    pcdump();
+    swapdump();
     break;
   case C('U'):  // Kill line.
     while(cons.e != cons.w &&
@@ -172,6 +178,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwake(&cons.pollq);
       }
     }
     break;
@@ -180,6 +187,23 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+// The console can always be written; it can be read once
+// a line has been typed. See filepoll().
+int
+consolepoll(int events, struct pollent *e)
+{
+  int r;
+
+  acquire(&cons.lock);
+  r = events & POLLOUT;
+  if(cons.r != cons.w)
+    r |= events & POLLIN;
+  if(r == 0 && e)
+    pollqueue(&cons.pollq, &cons.lock, e);
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -191,4 +215,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
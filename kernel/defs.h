@@ -2,10 +2,15 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct kmem_cache;
+struct mm;
 struct pipe;
+struct pollent;
 struct proc;
 struct spinlock;
 struct sleeplock;
+struct spawnact;
 struct stat;
 struct superblock;
 
@@ -13,6 +18,7 @@ struct superblock;
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            bdrop(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
@@ -24,6 +30,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execfault(pagetable_t, uint64, int);
 
 // file.c
 struct file*    filealloc(void);
@@ -33,6 +40,12 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filepread(struct file*, uint64, int, uint);
+int             filepwrite(struct file*, uint64, int, uint);
+int             filesend(struct file*, struct file*, uint*, int);
+int             filepoll(struct file*, int, struct pollent*);
 
 // fs.c
 void            fsinit(int);
@@ -42,16 +55,24 @@ struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilock_shared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            iunlock_shared(struct inode*);
 void            iunlockput(struct inode*);
+int             iwriteget(struct inode*);
+void            iwriteput(struct inode*);
+int             iexecget(struct inode*);
+void            iexecput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            ireadpage(struct inode*, uint, char*);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             writeiblocks(uint);
 void            itrunc(struct inode*);
 
 // ramdisk.c
@@ -59,36 +80,104 @@ void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void*           kmalloc(uint);
+void            kmfree(void*);
+void            slabdump(void);
+
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
 void            kfree(void *);
 void            kinit(void);
+int             kzeropage(void);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+void            kmemdump(void);
+void            kdup(void *);
+int             krefcnt(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+void            begin_op_n(int);
+int             log_opmax(void);
 void            end_op(void);
+void            log_sync(void);
+
+// pagecache.c
+void            pcinit(void);
+int             pcread(struct inode*, int, uint64, uint, uint);
+void            pcwrite(struct inode*, uint, char*, uint);
+void*           pcmap(struct inode*, uint);
+void            pcinval(struct inode*);
+int             pcshrink(void);
+void            pcdump(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int, int);
+int             pipewrite(struct pipe*, int, uint64, int, int);
+int             pipepoll(struct pipe*, int, int, struct pollent*);
 
 // printf.c
 void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
+// mmap.c
+uint64          mmap(uint64, uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+void            munmapall(struct proc*);
+int             mmapfork(struct proc*, struct proc*);
+int             mmapfault(pagetable_t, uint64, int);
+uint64          mmapbase(struct proc*);
+
+// futex.c
+void            futexinit(void);
+int             futex_wait(uint64, int);
+int             futex_wake(uint64, int);
+
+// poll.c
+void            pollinit(void);
+void            pollqueue(struct pollent**, struct spinlock*, struct pollent*);
+void            pollwake(struct pollent**);
+void            polltick(void);
+int             poll(uint64, int, int);
+
+// ring.c
+uint64          ring_setup(int);
+int             ring_enter(void);
+
+// swap.c
+void            swapinit(uint, uint, uint);
+void            swapdup(uint);
+void            swapfree(uint);
+int             swapin(pagetable_t, uint64);
+void            swappin(uint64, uint64, int);
+void            swapunpin(void);
+int             reclaim(int);
+void*           ualloc(int);
+void            swapdump(void);
+
 // proc.c
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             spawn(char*, char**, struct spawnact*, int);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+uint64          growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(struct proc *, pagetable_t, uint64);
 int             kill(int);
+void            kthread(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -104,6 +193,7 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             procinfo(uint64, int, uint64, int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -120,6 +210,9 @@ void            pop_off(void);
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+void            acquiresleep_shared(struct sleeplock*);
+void            releasesleep_shared(struct sleeplock*);
+int             holdingsleep_shared(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -138,6 +231,21 @@ int             argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+uint64          syscallv(int, uint64*);
+
+// timer.c
+void            timerqinit(void);
+int             timerwait(uint64);
+void            timertick(void);
+int             ticked(void);
+
+// tlb.c
+void            tlbinit(void);
+void            asidfree(pagetable_t);
+void            tlbinval(pagetable_t);
+int             tlbswitch(struct proc*);
+void            tlbpass(void);
+void            tlbwait(struct mm*);
 
 // trap.c
 extern uint     ticks;
@@ -165,8 +273,12 @@ uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmfault(pagetable_t, uint64, int);
+void            uvmtouch(uint64, uint64, int);
+uint64          uvmhold(uint64, int);
+pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -181,6 +293,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_writev(struct buf **, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -6,20 +6,46 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mm.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+static int
+flags2perm(int flags)
+{
+  int perm = 0;
+
+  if(flags & ELF_PROG_FLAG_READ)
+    perm |= PTE_R;
+  if(flags & ELF_PROG_FLAG_WRITE)
+    perm |= PTE_R | PTE_W;
+  if(flags & ELF_PROG_FLAG_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
 
+// The program's segments aren't read in here. exec() only
+// records them in p->mm->seg[], and execfault() fills in each
+// page when it is first touched.
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG+1], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct seg seg[NSEG];
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
+  struct mm *mm = p->mm;
+
+  // the other threads of the process would be left
+  // running the old program.
+  if(mm->ref > 1)
+    return -1;
 
   begin_op();
 
@@ -27,7 +53,7 @@ exec(char *path, char **argv)
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilock_shared(ip);
 
   // Check ELF header
   if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,31 +64,42 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Note where the program goes in memory. The segments
+  // must be in order and not share pages.
+  memset(seg, 0, sizeof(seg));
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
-    if(ph.type != ELF_PROG_LOAD)
+    if(ph.type != ELF_PROG_LOAD || ph.memsz == 0)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < sz)
       goto bad;
-    sz = sz1;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg >= NSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].perm = flags2perm(ph.flags);
+    nseg++;
+    sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // keep the reference to ip, for execfault(), and keep it
+  // from being written while the program runs.
+  if(iexecget(ip) < 0)
+    goto bad;
+  iunlock_shared(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
+  uint64 oldsz = mm->sz;
 
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
@@ -109,49 +146,105 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  munmapall(p);
+  p->ring = 0;
   oldpagetable = p->pagetable;
+  oldexe = mm->exe;
   p->pagetable = pagetable;
-  p->sz = sz;
+  mm->asid = 0;  // a new ASID for the new page table
+  mm->sz = sz;
+  mm->exe = exe;
+  memmove(mm->seg, seg, sizeof(seg));
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  proc_freepagetable(p, oldpagetable, oldsz);
+  if(oldexe){
+    iexecput(oldexe);
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
-    proc_freepagetable(pagetable, sz);
+    proc_freepagetable(p, pagetable, sz);
   if(ip){
-    iunlockput(ip);
+    iunlock_shared(ip);
+    iput(ip);
+    end_op();
+  }
+  if(exe){
+    iexecput(exe);
+    begin_op();
+    iput(exe);
     end_op();
   }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+// Handle a fault at va in pagetable, which needs one of
+// PTE_R, PTE_W or PTE_X, by paging in the program. A whole
+// page of a read-only segment is the page cache's own page,
+// shared by every process running the program; other pages
+// are private copies.
+// Returns 0 if the access may be retried, -1 if it is an error.
+int
+execfault(pagetable_t pagetable, uint64 va, int perm)
 {
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
+  struct proc *p = myproc();
+  struct mm *mm;
+  struct seg *s;
+  pte_t *pte;
+  uint64 a, off;
+  char *mem;
+  uint n;
+
+  if(p == 0 || pagetable != p->pagetable)
+    return -1;
+  mm = p->mm;
+  if(mm->exe == 0 || va >= mm->sz)
+    return -1;
+  va = PGROUNDDOWN(va);
+  for(s = mm->seg; s < &mm->seg[NSEG]; s++)
+    if(s->memsz && va >= s->va && va < s->va + s->memsz)
+      break;
+  if(s == &mm->seg[NSEG] || (s->perm & perm) == 0)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) != 0 && *pte != 0)
+    return -1;  // present, or swapped out
+  // reading the file may sleep, which can't be done while
+  // holding a spinlock, as copyout() callers sometimes do.
+  if(!intr_get())
+    return -1;
+
+  a = va - s->va;
+  off = s->off + a;
+  if((s->perm & PTE_W) == 0 && off % PGSIZE == 0 && a + PGSIZE <= s->filesz){
+    ilock_shared(mm->exe);
+    mem = pcmap(mm->exe, off / PGSIZE);
+    iunlock_shared(mm->exe);
+    if(mem == 0)
+      return -1;
+  } else {
+    if((mem = ualloc(1)) == 0)
       return -1;
+    if(a < s->filesz){
+      n = s->filesz - a < PGSIZE ? s->filesz - a : PGSIZE;
+      ilock_shared(mm->exe);
+      if(readi(mm->exe, 0, (uint64)mem, off, n) != n){
+        iunlock_shared(mm->exe);
+        kfree(mem);
+        return -1;
+      }
+      iunlock_shared(mm->exe);
+    }
+  }
+
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, s->perm | PTE_U) != 0){
+    kfree(mem);
+    return -1;
   }
-  
   return 0;
 }
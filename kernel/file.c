@@ -12,35 +12,34 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "uio.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;        // protects ref counts
+  struct kmem_cache *cache;    // where struct files come from
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
+// Returns 0 if out of memory.
 struct file*
 filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,13 +68,14 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
+    if(ff.type == FD_INODE && ff.writable)
+      iwriteput(ff.ip);
     begin_op();
     iput(ff.ip);
     end_op();
@@ -91,9 +91,9 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilock_shared(f->ip);
     stati(f->ip, &st);
-    iunlock(f->ip);
+    iunlock_shared(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
       return -1;
     return 0;
@@ -101,27 +101,119 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Read f's inode into the niov buffers of iov, at f->off,
+// advancing it. Returns the number of bytes read.
+static int
+readiov(struct file *f, struct iovec *iov, int niov)
+{
+  int i, r, tot = 0;
+
+  // the copy happens with the inode locked, so fault in
+  // the destination now.
+  for(i = 0; i < niov; i++)
+    uvmtouch((uint64)iov[i].base, iov[i].len, PTE_W);
+
+  // f->off may be shared, by other processes or by threads
+  // sharing the file table, so the exclusive lock serializes
+  // the offset updates. pread() leaves f->off alone, and so
+  // can read in parallel with other readers.
+  ilock(f->ip);
+  for(i = 0; i < niov; i++){
+    r = readi(f->ip, 1, (uint64)iov[i].base, f->off, iov[i].len);
+    f->off += r;
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  iunlock(f->ip);
+  return tot;
+}
+
+// Write the niov buffers of iov to f's inode at *off,
+// advancing it, in as few log transactions as they fit in.
+// The buffers are in user space if user_src is set, else in
+// the kernel. Returns the number of bytes written, or -1.
+static int
+writeiov(struct file *f, struct iovec *iov, int niov, int user_src, uint *off)
+{
+  int i, n, m, max, r = 0, tot = 0, left = 0;
+  uint o = 0;  // bytes of iov[i] written so far
+
+  for(i = 0; i < niov; i++){
+    left += iov[i].len;
+    if(user_src)
+      uvmtouch((uint64)iov[i].base, iov[i].len, PTE_R);
+  }
+
+  i = 0;
+  while(i < niov && left > 0){
+    // write as much as a transaction can take, reserving
+    // just the log blocks it needs (see writeiblocks()).
+    // this really belongs lower down, since writei()
+    // might be writing a device like the console.
+    max = left;
+    if(max > log_opmax() * BSIZE)
+      max = log_opmax() * BSIZE;
+    while(writeiblocks(max) > log_opmax())
+      max -= BSIZE;
+    begin_op_n(writeiblocks(max));
+    ilock(f->ip);
+    // as many buffers, or pieces of them, as add up to max.
+    for(n = 0; n < max && i < niov; n += r){
+      m = iov[i].len - o;
+      if(m > max - n)
+        m = max - n;
+      if((r = writei(f->ip, user_src, (uint64)iov[i].base + o, *off, m)) < 0)
+        break;
+      if(r != m)
+        panic("short filewrite");
+      *off += r;
+      tot += r;
+      if((o += r) == iov[i].len){
+        i++;
+        o = 0;
+      }
+    }
+    iunlock(f->ip);
+    end_op();
+    if(r < 0)
+      return -1;
+    left -= n;
+  }
+  return tot;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
 fileread(struct file *f, uint64 addr, int n)
 {
+  struct iovec iov;
   int r = 0;
 
   if(f->readable == 0)
     return -1;
 
+  // the copy happens with locks held, so fault in the
+  // destination now. pipes and devices also copy after
+  // sleeping, so their pages must stay in memory until then.
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    swappin(addr, n, PTE_W);
+    r = piperead(f->pipe, 1, addr, n, f->nonblock);
+    swapunpin();
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
+    // devices don't know about O_NONBLOCK, so ask first.
+    if(f->nonblock && filepoll(f, POLLIN, 0) == 0)
+      return -1;
+    swappin(addr, n, PTE_W);
     r = devsw[f->major].read(1, addr, n);
+    swapunpin();
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    iov.base = (void*)addr;
+    iov.len = n;
+    r = readiov(f, &iov, 1);
   } else {
     panic("fileread");
   }
@@ -134,45 +226,27 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
+  // as for fileread().
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    swappin(addr, n, PTE_R);
+    ret = pipewrite(f->pipe, 1, addr, n, f->nonblock);
+    swapunpin();
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
+    swappin(addr, n, PTE_R);
     ret = devsw[f->major].write(1, addr, n);
+    swapunpin();
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r < 0)
-        break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    iov.base = (void*)addr;
+    iov.len = n;
+    ret = (writeiov(f, &iov, 1, 1, &f->off) == n ? n : -1);
   } else {
     panic("filewrite");
   }
@@ -180,3 +254,201 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+
+// Read from file f into the niov buffers of iov, which
+// must have been copied in from user space, filling each
+// before the next. Returns the number of bytes read, or -1.
+int
+filereadv(struct file *f, struct iovec *iov, int niov)
+{
+  int i, r, tot = 0;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_INODE)
+    return readiov(f, iov, niov);
+
+  // a pipe or device: a read per buffer, until one
+  // comes up short.
+  for(i = 0; i < niov; i++){
+    if((r = fileread(f, (uint64)iov[i].base, iov[i].len)) < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  return tot;
+}
+
+// Write the niov buffers of iov, which must have been
+// copied in from user space, to file f, one after another.
+// Returns the number of bytes written, or -1.
+int
+filewritev(struct file *f, struct iovec *iov, int niov)
+{
+  int i, r, tot = 0;
+
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_INODE)
+    return writeiov(f, iov, niov, 1, &f->off);
+
+  for(i = 0; i < niov; i++){
+    if((r = filewrite(f, (uint64)iov[i].base, iov[i].len)) < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+  }
+  return tot;
+}
+
+// Read n bytes from file f at offset off, to user address
+// addr, leaving f->off alone. Only for files with inodes.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  uvmtouch(addr, n, PTE_W);
+  // f->off isn't touched, so readers can share the inode.
+  ilock_shared(f->ip);
+  r = readi(f->ip, 1, addr, off, n);
+  iunlock_shared(f->ip);
+  return r;
+}
+
+// Write n bytes from user address addr to file f at
+// offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  iov.base = (void*)addr;
+  iov.len = n;
+  return writeiov(f, &iov, 1, 1, &off) == n ? n : -1;
+}
+
+// Write n bytes at kernel address src to f, for filesend().
+// Returns the number written, or -1.
+static int
+writek(struct file *f, char *src, int n)
+{
+  struct iovec iov;
+
+  if(f->type == FD_PIPE)
+    return pipewrite(f->pipe, 0, (uint64)src, n, f->nonblock);
+  if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+      return -1;
+    return devsw[f->major].write(0, (uint64)src, n);
+  }
+  iov.base = src;
+  iov.len = n;
+  return writeiov(f, &iov, 1, 0, &f->off);
+}
+
+// Move up to n bytes from file in to file out, without
+// copying them through user space. A file's data is written
+// straight from its page cache pages; a pipe or device is
+// read a page at a time into a kernel buffer. A file is read
+// at *off if off isn't 0, else at in->off, which advances.
+// Returns the number of bytes moved, or -1.
+int
+filesend(struct file *out, struct file *in, uint *off, int n)
+{
+  char *pa, *buf = 0;
+  uint o = off ? *off : 0;
+  int m, r = 0, tot = 0;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+
+  while(tot < n){
+    m = n - tot;
+    if(in->type == FD_INODE){
+      // in->off may be shared, so claim each piece by advancing
+      // it under the exclusive lock, as readiov() does. That
+      // lock can't be held across writek(), which may begin_op().
+      if(off)
+        ilock_shared(in->ip);
+      else {
+        ilock(in->ip);
+        o = in->off;
+      }
+      if(o < in->ip->size && m > in->ip->size - o)
+        m = in->ip->size - o;
+      if(m > PGSIZE - o % PGSIZE)
+        m = PGSIZE - o % PGSIZE;
+      pa = o < in->ip->size ? pcmap(in->ip, o / PGSIZE) : 0;
+      if(off)
+        iunlock_shared(in->ip);
+      else {
+        if(pa)
+          in->off = o + m;
+        iunlock(in->ip);
+      }
+      if(pa == 0)
+        break;
+      r = writek(out, pa + o % PGSIZE, m);
+      kfree(pa);
+      if(off == 0 && r < m){
+        // give back what wasn't sent, unless in->off has moved on.
+        ilock(in->ip);
+        if(in->off == o + m)
+          in->off = o + (r > 0 ? r : 0);
+        iunlock(in->ip);
+      }
+    } else {
+      if(buf == 0 && (buf = kalloc()) == 0)
+        break;
+      if(m > PGSIZE)
+        m = PGSIZE;
+      if(in->type == FD_PIPE)
+        m = piperead(in->pipe, 0, (uint64)buf, m, in->nonblock);
+      else if(in->major >= 0 && in->major < NDEV && devsw[in->major].read)
+        m = devsw[in->major].read(0, (uint64)buf, m);
+      else
+        m = -1;
+      if(m <= 0){
+        r = m;
+        break;
+      }
+      r = writek(out, buf, m);
+    }
+    if(r < 0)
+      break;
+    o += r;
+    tot += r;
+    if(r < m)
+      break;
+  }
+
+  if(buf)
+    kfree(buf);
+  if(in->type == FD_INODE && off)
+    *off = o;
+  return tot == 0 && r < 0 ? -1 : tot;
+}
+
+// Which of events (POLLIN, POLLOUT) f is ready for, plus
+// POLLHUP if f is a pipe whose other end is closed. If none,
+// queue e, unless it is 0, to be woken when that changes.
+// See poll.c.
+int
+filepoll(struct file *f, int events, struct pollent *e)
+{
+  if(!f->readable)
+    events &= ~POLLIN;
+  if(!f->writable)
+    events &= ~POLLOUT;
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable, events, e);
+  if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV && devsw[f->major].poll)
+    return devsw[f->major].poll(events, e);
+  // files never make anyone wait.
+  return events & (POLLIN|POLLOUT);
+}
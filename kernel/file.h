@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK: fail rather than wait
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
@@ -18,6 +19,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int writecount;     // open for writing if > 0; -(programs running it) if < 0
+  struct inode *next; // icache list
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -29,10 +32,13 @@ struct inode {
   uint addrs[NDIRECT+1];
 };
 
+struct pollent;
+
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(int, struct pollent*);  // see filepoll()
 };
 
 extern struct devsw devsw[];
@@ -44,6 +44,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  swapinit(dev, sb.swapstart, sb.nswap);
 }
 
 // Zero a block.
@@ -127,18 +128,16 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref,
+//   and frees the entry when ref reaches zero.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   the disk and sets ip->valid.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -162,29 +161,37 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The icache.lock spin-lock protects the list of icache
+// entries. An entry whose ip->ref drops to zero stays on the
+// list, so a later iget() finds it still valid; iget() recycles
+// the least recently used such entry once NINODE are cached.
+// Since ip->ref decides when an entry is recycled, and ip->dev
+// and ip->inum indicate which i-node an entry holds, one must
+// hold icache.lock while using any of those fields.
+//
+// ip->writecount, also protected by icache.lock, keeps a file
+// that is open for writing from being run as a program, and
+// one that is running (see execfault()) from being written or
+// truncated.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// writecount, dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// Paths that only read the inode and its content (readi, stati,
+// dirlookup during path lookup) can use ilock_shared() instead of
+// ilock(), so that many processes can read a hot inode at once.
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *head;       // entries, through ip->next
+  struct kmem_cache *cache; // where entries come from
 } icache;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode));
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -242,30 +249,48 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, *unused;
+  int nunused;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  unused = 0;
+  nunused = 0;
+  for(ip = icache.head; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+    if(ip->ref == 0){
+      unused = ip;   // the least recently used one, in the end
+      nunused++;
+    }
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  // Make a new entry, unless NINODE unused ones are cached or
+  // there is no memory for one: then recycle an unused entry.
+  if(nunused >= NINODE){
+    ip = unused;
+  } else if((ip = kmem_cache_alloc(icache.cache)) != 0){
+    initsleeplock(&ip->lock, "inode");
+    ip->next = icache.head;
+    icache.head = ip;
+  } else if(unused){
+    ip = unused;
+  } else {
+    // out of memory: make room and look again, since the
+    // inode may have been cached meanwhile.
+    release(&icache.lock);
+    if(reclaim(1) == 0)
+      panic("iget: no inodes");
+    return iget(dev, inum);
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
+  ip->writecount = 0;
   ip->valid = 0;
   release(&icache.lock);
 
@@ -283,6 +308,58 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Note that ip is open for writing. Returns 0, or -1 if a
+// program is running from it.
+int
+iwriteget(struct inode *ip)
+{
+  int r = -1;
+
+  acquire(&icache.lock);
+  if(ip->writecount >= 0){
+    ip->writecount++;
+    r = 0;
+  }
+  release(&icache.lock);
+  return r;
+}
+
+void
+iwriteput(struct inode *ip)
+{
+  acquire(&icache.lock);
+  if(ip->writecount <= 0)
+    panic("iwriteput");
+  ip->writecount--;
+  release(&icache.lock);
+}
+
+// Note that a program is running from ip, for exec(). Returns
+// 0, or -1 if ip is open for writing.
+int
+iexecget(struct inode *ip)
+{
+  int r = -1;
+
+  acquire(&icache.lock);
+  if(ip->writecount <= 0){
+    ip->writecount--;
+    r = 0;
+  }
+  release(&icache.lock);
+  return r;
+}
+
+void
+iexecput(struct inode *ip)
+{
+  acquire(&icache.lock);
+  if(ip->writecount >= 0)
+    panic("iexecput");
+  ip->writecount++;
+  release(&icache.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -312,6 +389,28 @@ ilock(struct inode *ip)
   }
 }
 
+// Lock the given inode for reading only.
+// Other readers may hold the lock at the same time,
+// so the caller must not modify the inode or its content.
+// Reads the inode from disk if necessary.
+void
+ilock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilock_shared");
+
+  acquiresleep_shared(&ip->lock);
+
+  while(ip->valid == 0){
+    // filling in the inode from disk needs the exclusive lock.
+    // ip->ref > 0, so ip->valid can't be cleared again once set.
+    releasesleep_shared(&ip->lock);
+    ilock(ip);
+    iunlock(ip);
+    acquiresleep_shared(&ip->lock);
+  }
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
@@ -322,6 +421,16 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Drop a shared lock taken with ilock_shared().
+void
+iunlock_shared(struct inode *ip)
+{
+  if(ip == 0 || !holdingsleep_shared(&ip->lock) || ip->ref < 1)
+    panic("iunlock_shared");
+
+  releasesleep_shared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
 // be recycled.
@@ -353,7 +462,16 @@ iput(struct inode *ip)
     acquire(&icache.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0 && icache.head != ip){
+    // no one refers to ip any more, but keep it cached, at the
+    // front of the list so that iget() recycles it last.
+    struct inode **pp;
+    for(pp = &icache.head; *pp != ip; pp = &(*pp)->next)
+      ;
+    *pp = ip->next;
+    ip->next = icache.head;
+    icache.head = ip;
+  }
   release(&icache.lock);
 }
 
@@ -413,6 +531,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcinval(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -437,7 +557,7 @@ itrunc(struct inode *ip)
 }
 
 // Copy stat information from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared or exclusive.
 void
 stati(struct inode *ip, struct stat *st)
 {
@@ -448,31 +568,40 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
-// Read data from inode.
-// Caller must hold ip->lock.
+// Read data from inode, through the page cache.
+// Caller must hold ip->lock, shared or exclusive.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
-
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
-      brelse(bp);
+  return pcread(ip, user_dst, dst, off, n);
+}
+
+// Fill pa with page pgoff of ip's data, for the page cache.
+// The part past the end of the file is zeroed.
+// Caller must hold ip->lock, shared or exclusive.
+void
+ireadpage(struct inode *ip, uint pgoff, char *pa)
+{
+  uint off, i;
+  struct buf *bp;
+
+  for(i = 0; i < PGSIZE; i += BSIZE){
+    off = pgoff*PGSIZE + i;
+    if(off >= ip->size){
+      memset(pa + i, 0, PGSIZE - i);
       break;
     }
-    brelse(bp);
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    memmove(pa + i, bp->data, BSIZE);
+    bdrop(bp);
   }
-  return tot;
 }
 
 // Write data to inode.
@@ -497,8 +626,9 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    pcwrite(ip, off, (char*)bp->data + (off % BSIZE), m);
     log_write(bp);
-    brelse(bp);
+    bdrop(bp);
   }
 
   if(n > 0){
@@ -513,6 +643,22 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return n;
 }
 
+// The most blocks that writei() of n bytes may change, to
+// reserve in the log: the data blocks, however the bytes fall
+// across them, the bitmap blocks that allocating them touches,
+// the indirect block, and the inode.
+int
+writeiblocks(uint n)
+{
+  int d, nbitmap;
+
+  if(n == 0)
+    return 1;
+  d = (n + BSIZE - 2) / BSIZE + 1;
+  nbitmap = sb.size / BPB + 1;
+  return d + (d < nbitmap ? d : nbitmap) + 1 + 1;
+}
+
 // Directories
 
 int
@@ -523,6 +669,7 @@ namecmp(const char *s, const char *t)
 
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock, shared or exclusive.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
@@ -626,28 +773,39 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  struct fdtable *fdt;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    // another thread may be changing cwd.
+    fdt = myproc()->fdt;
+    acquire(&fdt->lock);
+    ip = idup(fdt->cwd);
+    release(&fdt->lock);
+  }
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    // lookups only read the directory, so many processes
+    // can walk through the same directory at once.
+    ilock_shared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlock_shared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlock_shared(ip);
       return ip;
     }
     if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+      iunlock_shared(ip);
+      iput(ip);
       return 0;
     }
-    iunlockput(ip);
+    iunlock_shared(ip);
+    iput(ip);
     ip = next;
   }
   if(nameiparent){
@@ -0,0 +1,109 @@
+// Futexes: sleeping on a word of user memory.
+//
+// futex_wait(addr, val) sleeps for as long as the int at addr
+// holds val, and futex_wake(addr, n) wakes up to n of the
+// processes sleeping on addr; user code builds locks out of
+// them (see ulib.c) that sleep only when contended. Waiters
+// are kept in a hash table by the physical address of addr,
+// so that threads, and processes sharing an mmap()ed file,
+// find each other. A waiter holds a reference to the page,
+// so that it is neither swapped out nor reused meanwhile.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEX 31
+#define HASH(pa) (((pa) / sizeof(int)) % NFUTEX)
+
+// A process in futex_wait(), on its kernel stack.
+struct waiter {
+  uint64 pa;
+  int woken;
+  struct waiter *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct waiter *head;
+} futex[NFUTEX];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEX; i++)
+    initlock(&futex[i].lock, "futex");
+}
+
+// Sleep until futex_wake(addr), if the int at addr is val.
+// Returns 0 when woken, -1 if *addr isn't val or the
+// process is killed.
+int
+futex_wait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct waiter w, **wp;
+  uint64 pa;
+  int h;
+
+  if(addr % sizeof(int) != 0 || (pa = uvmhold(addr, PTE_R)) == 0)
+    return -1;
+  h = HASH(pa);
+
+  // futex_wake() needs the lock too, so a wakeup that follows
+  // a change to *addr can't be missed.
+  acquire(&futex[h].lock);
+  if(*(volatile int*)pa != val){
+    release(&futex[h].lock);
+    kfree((void*)PGROUNDDOWN(pa));
+    return -1;
+  }
+  w.pa = pa;
+  w.woken = 0;
+  w.next = futex[h].head;
+  futex[h].head = &w;
+  while(!w.woken && !p->killed)
+    sleep(&w, &futex[h].lock);
+  if(!w.woken){
+    for(wp = &futex[h].head; *wp != &w; wp = &(*wp)->next)
+      ;
+    *wp = w.next;
+  }
+  release(&futex[h].lock);
+  kfree((void*)PGROUNDDOWN(pa));
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n processes sleeping on addr.
+// Returns the number woken, or -1.
+int
+futex_wake(uint64 addr, int n)
+{
+  struct waiter *w, **wp;
+  uint64 pa;
+  int h, nwoken = 0;
+
+  if(addr % sizeof(int) != 0 || (pa = uvmhold(addr, PTE_R)) == 0)
+    return -1;
+  h = HASH(pa);
+
+  acquire(&futex[h].lock);
+  for(wp = &futex[h].head; *wp && nwoken < n; ){
+    w = *wp;
+    if(w->pa != pa){
+      wp = &w->next;
+      continue;
+    }
+    *wp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    nwoken++;
+  }
+  release(&futex[h].lock);
+  kfree((void*)PGROUNDDOWN(pa));
+  return nwoken;
+}
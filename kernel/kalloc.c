@@ -1,6 +1,7 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. A buddy allocator: hands out
+// naturally aligned blocks of 2^order 4096-byte pages.
 
 #include "types.h"
 #include "param.h"
@@ -9,74 +10,371 @@
 #include "riscv.h"
 #include "defs.h"
 
-void freerange(void *pa_start, void *pa_end);
+// number of pre-zeroed pages that idle harts keep ready
+// for kalloc_zeroed().
+#define NZEROPAGES 128
+
+// per-page metadata, indexed by (pa - KERNBASE) / PGSIZE.
+#define NPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PG_FREE 0x80 // page heads a free block; low bits hold its order
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
 struct run {
   struct run *next;
+  struct run *prev; // only on the buddy free lists
 };
 
+// A free block of order k starts at a physical address
+// that is a multiple of PGSIZE << k, so its buddy is found
+// by flipping one bit of the address. Only the first page
+// of a free block is marked in kmem.page[]; every other page
+// reads as allocated, which also lets a block be freed a
+// piece at a time (e.g. a split megapage).
+//
+// At boot, kinit() puts the largest aligned blocks that fit
+// on the free lists, so it touches one page per 4MB instead
+// of every page of RAM.
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run free[MAXORDER+1]; // circular lists, one per order
+  uchar page[NPAGES];
+  ushort ref[NPAGES];   // references to each allocated page
+  struct run *zerolist; // pages that are all zeroes but for r->next
+  int nzero;            // length of zerolist
+
+  // statistics, per order.
+  int nfree[MAXORDER+1];   // blocks on the free list
+  uint64 nalloc[MAXORDER+1]; // kalloc_order() calls that succeeded
+  uint64 nsplit[MAXORDER+1]; // blocks split to serve a smaller order
+  uint64 nmerge[MAXORDER+1]; // buddies coalesced into this order
 } kmem;
 
+static void freeblock(char *, int);
+
 void
 kinit()
 {
+  char *p;
+  int k;
+
   initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  for(k = 0; k <= MAXORDER; k++)
+    kmem.free[k].next = kmem.free[k].prev = &kmem.free[k];
+
+  p = (char*)PGROUNDUP((uint64)end);
+  while(p < (char*)PHYSTOP){
+    for(k = MAXORDER; k > 0; k--){
+      if((uint64)p % (PGSIZE << k) == 0 && p + (PGSIZE << k) <= (char*)PHYSTOP)
+        break;
+    }
+    freeblock(p, k);
+    p += PGSIZE << k;
+  }
 }
 
-void
-freerange(void *pa_start, void *pa_end)
+static uchar*
+pagemeta(char *pa)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  return &kmem.page[((uint64)pa - KERNBASE) / PGSIZE];
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
-void
-kfree(void *pa)
+static ushort*
+pageref(void *pa)
+{
+  return &kmem.ref[((uint64)pa - KERNBASE) / PGSIZE];
+}
+
+// Give each page of a newly allocated block of order k
+// one reference. Caller must hold kmem.lock.
+static void
+setref(struct run *r, int k)
+{
+  for(int i = 0; i < (1 << k); i++)
+    *pageref((char*)r + i*PGSIZE) = 1;
+}
+
+// Put a block on the order k free list.
+// Caller must hold kmem.lock (or be kinit()).
+static void
+freeblock(char *pa, int k)
+{
+  struct run *r = (struct run*)pa;
+
+  r->next = kmem.free[k].next;
+  r->prev = &kmem.free[k];
+  r->next->prev = r;
+  kmem.free[k].next = r;
+  *pagemeta(pa) = PG_FREE | k;
+  kmem.nfree[k]++;
+}
+
+// Take a block off the order k free list.
+// Caller must hold kmem.lock.
+static void
+unfreeblock(struct run *r, int k)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  *pagemeta((char*)r) = 0;
+  kmem.nfree[k]--;
+}
+
+// Find a free block of order k, splitting a larger one if
+// need be. Caller must hold kmem.lock.
+static struct run*
+buddyalloc(int k)
 {
   struct run *r;
+  int j;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+  for(j = k; j <= MAXORDER; j++)
+    if(kmem.free[j].next != &kmem.free[j])
+      break;
+  if(j > MAXORDER)
+    return 0;
+  r = kmem.free[j].next;
+  unfreeblock(r, j);
+  // give back the upper halves.
+  while(j > k){
+    j--;
+    kmem.nsplit[j+1]++;
+    freeblock((char*)r + (PGSIZE << j), j);
+  }
+  kmem.nalloc[k]++;
+  return r;
+}
+
+// Return a block of order k to the free lists, merging it
+// with its buddy for as long as the buddy is free too.
+// Caller must hold kmem.lock.
+static void
+buddyfree(char *pa, int k)
+{
+  char *buddy;
+  uchar *m;
+
+  while(k < MAXORDER){
+    buddy = (char*)((uint64)pa ^ (PGSIZE << k));
+    if(buddy < end || buddy >= (char*)PHYSTOP)
+      break;
+    m = pagemeta(buddy);
+    if(*m != (PG_FREE | k))
+      break;
+    unfreeblock((struct run*)buddy, k);
+    if(buddy < pa)
+      pa = buddy;
+    k++;
+    kmem.nmerge[k]++;
+  }
+  freeblock(pa, k);
+}
+
+// Free the block of 2^order pages at pa, which normally
+// should have been returned by a call to kalloc_order().
+// A single page is only freed once the last reference
+// taken with kdup() is gone. If some page of a larger block
+// still has other references (e.g. uvmhold() on a megapage),
+// the block is freed page by page, and those pages stay.
+void
+kfree_order(void *pa, int order)
+{
+  int shared = 0;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kfree_order: order");
+  if(((uint64)pa % (PGSIZE << order)) != 0 || (char*)pa < end ||
+     (uint64)pa + (PGSIZE << order) > PHYSTOP)
     panic("kfree");
 
+  acquire(&kmem.lock);
+  if(*pagemeta(pa) & PG_FREE)
+    panic("kfree: free");
+  if(order == 0 && *pageref(pa) > 1){
+    (*pageref(pa))--;
+    release(&kmem.lock);
+    return;
+  }
+  for(int i = 0; order > 0 && i < (1 << order); i++)
+    if(*pageref((char*)pa + i*PGSIZE) > 1)
+      shared = 1;
+  if(shared){
+    release(&kmem.lock);
+    for(int i = 0; i < (1 << order); i++)
+      kfree_order((char*)pa + i*PGSIZE, 0);
+    return;
+  }
+  *pageref(pa) = 0;
+#ifdef KJUNK
+  release(&kmem.lock);
   // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  memset(pa, 1, PGSIZE << order);
+  acquire(&kmem.lock);
+#endif
+  buddyfree((char*)pa, order);
+  release(&kmem.lock);
+}
 
-  r = (struct run*)pa;
+// Take another reference to the allocated page pa,
+// e.g. to map it into a second address space.
+// kfree() drops one.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  acquire(&kmem.lock);
+  if(*pageref(pa) < 1)
+    panic("kdup: free");
+  (*pageref(pa))++;
+  release(&kmem.lock);
+}
+
+// Number of references to the allocated page pa.
+int
+krefcnt(void *pa)
+{
+  int n;
 
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  n = *pageref(pa);
   release(&kmem.lock);
+  return n;
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Returns 0 if the memory cannot be allocated.
+// The contents are undefined.
+void *
+kalloc_order(int order)
+{
+  struct run *r;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kalloc_order: order");
+
+  acquire(&kmem.lock);
+  if((r = buddyalloc(order)) != 0)
+    setref(r, order);
+  release(&kmem.lock);
+
+#ifdef KJUNK
+  if(r)
+    memset((char*)r, 5, PGSIZE << order); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Free the page of physical memory pointed at by pa,
+// which normally should have been returned by a
+// call to kalloc(). It may also be one page of a
+// larger block from kalloc_order().
+void
+kfree(void *pa)
+{
+  kfree_order(pa, 0);
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// The page's contents are undefined; use
+// kalloc_zeroed() if the caller needs zeroes.
 void *
 kalloc(void)
 {
   struct run *r;
 
   acquire(&kmem.lock);
-  r = kmem.freelist;
+  // an order-0 block is usually at hand; only split
+  // when there isn't one.
+  if((r = kmem.free[0].next) != &kmem.free[0]){
+    unfreeblock(r, 0);
+    kmem.nalloc[0]++;
+  } else if((r = buddyalloc(0)) == 0 && (r = kmem.zerolist) != 0){
+    // out of dirty pages, fall back on the zeroed pool.
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+  }
   if(r)
-    kmem.freelist = r->next;
+    setref(r, 0);
   release(&kmem.lock);
 
+#ifdef KJUNK
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Allocate one page of physical memory filled with zeroes.
+// Takes a page from the pool that idle harts zero ahead
+// of time, so the caller doesn't have to.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = kmem.zerolist;
+  if(r){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+    setref(r, 0);
+  }
+  release(&kmem.lock);
+
+  if(r){
+    r->next = 0;
+    return (void*)r;
+  }
+
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
   return (void*)r;
 }
+
+// Move one free page to the zeroed pool, zeroing it.
+// Called by scheduler() when there is nothing to run.
+// Returns 1 if a page was zeroed, 0 if the pool is full
+// or there are no free pages.
+int
+kzeropage(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  if(kmem.nzero >= NZEROPAGES || (r = buddyalloc(0)) == 0){
+    release(&kmem.lock);
+    return 0;
+  }
+  // count it now so that other harts don't overfill the pool.
+  kmem.nzero++;
+  release(&kmem.lock);
+
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  r->next = kmem.zerolist;
+  kmem.zerolist = r;
+  release(&kmem.lock);
+  return 1;
+}
+
+// Print allocator statistics. For ^P; doesn't take
+// kmem.lock, so the numbers may be slightly off.
+void
+kmemdump(void)
+{
+  uint64 npages = kmem.nzero;
+
+  printf("order  free  allocs  splits  merges\n");
+  for(int k = 0; k <= MAXORDER; k++){
+    printf("%d  %d  %d  %d  %d\n", k, kmem.nfree[k], (int)kmem.nalloc[k],
+           (int)kmem.nsplit[k], (int)kmem.nmerge[k]);
+    npages += (uint64)kmem.nfree[k] << k;
+  }
+  printf("%d pages free, %d pre-zeroed\n", (int)npages, kmem.nzero);
+}
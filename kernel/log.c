@@ -3,6 +3,7 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
@@ -16,10 +17,24 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves room in the log for
+// the MAXOPBLOCKS blocks a system call may write, or, with
+// begin_op_n(), for as many as the caller says it will write,
+// such as a big write() working in large pieces. Usually it
+// just adds to the count of in-progress FS system calls and
+// returns. But if the log could run out, it sleeps until the
+// last outstanding end_op() commits. The log's size comes from
+// the superblock.
+//
+// Commits are put off: the blocks of a finished system call
+// stay in the buffer cache, pinned, as part of the running
+// transaction, until the log is close to full, fsync() asks
+// for a commit (log_sync()), or the flusher thread does its
+// periodic one. So a block that system call after system call
+// writes, like a bitmap or inode block, goes to the log and
+// home once per commit rather than once per call. A crash
+// loses the calls of the last COMMITTICKS or so, but leaves
+// the file system consistent.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,176 +43,339 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// The header carries a checksum over itself and the logged
+// blocks, so a commit writes the header and the blocks as one
+// batch, in no particular order: if a crash tears the batch,
+// recovery finds that the checksum doesn't match and ignores
+// the log. Nor is the header cleared after the blocks are
+// installed; the next commit overwrites it, with the next
+// sequence number, and until then recovery just installs the
+// last transaction again, which does no harm.
+
+#define LOGMAX (BSIZE/sizeof(int) - 3)  // most blocks the header can list
+#define LOGBATCH 8  // log blocks written or installed at a time
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  uint seq;    // which commit this is
+  uint cksum;  // over the rest of the header and the logged blocks
+  int block[LOGMAX];
 };
 
+#define COMMITTICKS 10  // the flusher commits this often
+
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // blocks the log can hold, after the header.
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // blocks they have reserved.
   int committing;  // in commit(), please wait.
+  int want;        // the last end_op() should commit.
+  uint ncommit;    // commits done.
+  uint seq;        // the next commit's sequence number.
   int dev;
   struct logheader lh;
+  struct buf io[LOGBATCH+1];  // for writing the log and its header.
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void docommit(void);
+static void flusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
-  log.size = sb->nlog;
+  log.size = sb->nlog - 1;
+  if (log.size > LOGMAX)
+    log.size = LOGMAX;
+  if (log.size < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
   recover_from_log();
+  kthread("flusher", flusher);
+}
+
+// FNV-1a, a word at a time, of the n bytes at p, continuing
+// from h.
+static uint
+cksum(uint h, void *p, int n)
+{
+  uint *w = p;
+  int i;
+
+  for (i = 0; i < n / sizeof(uint); i++)
+    h = (h ^ w[i]) * 16777619;
+  return h;
 }
 
-// Copy committed blocks from log to their home location
+// Checksum of the header lh, to be continued over the logged blocks.
+static uint
+headsum(struct logheader *lh)
+{
+  uint h = 2166136261;
+
+  h = cksum(h, &lh->n, sizeof(lh->n));
+  h = cksum(h, &lh->seq, sizeof(lh->seq));
+  return cksum(h, lh->block, lh->n * sizeof(lh->block[0]));
+}
+
+// Copy committed blocks to their home location, a batch at a
+// time. After a commit they are still in the cache, pinned;
+// when recovering they have to be read from the log.
 static void
-install_trans(void)
+install_trans(int recovering)
 {
-  int tail;
+  struct buf *bs[LOGBATCH];
+  int tail, m, i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < log.lh.n; tail += m) {
+    for (m = 0; m < LOGBATCH && tail+m < log.lh.n; m++) {
+      struct buf *dbuf = bread(log.dev, log.lh.block[tail+m]); // read dst
+      if (recovering) {
+        struct buf *lbuf = bread(log.dev, log.start+tail+m+1); // read log block
+        memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+        brelse(lbuf);
+      }
+      bs[m] = dbuf;
+    }
+    virtio_disk_writev(bs, m);  // write dst to disk
+    for (i = 0; i < m; i++) {
+      if (!recovering)
+        bunpin(bs[i]);
+      brelse(bs[i]);
+    }
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the log header from disk into the in-memory log header.
+// Leaves log.lh.n zero unless the log holds a whole committed
+// transaction, i.e. the header's checksum matches.
 static void
 read_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
+  uint sum;
   int i;
   log.lh.n = lh->n;
+  log.lh.seq = lh->seq;
+  log.lh.cksum = lh->cksum;
+  if (log.lh.n < 0 || log.lh.n > log.size)
+    log.lh.n = 0;  // garbage
   for (i = 0; i < log.lh.n; i++) {
     log.lh.block[i] = lh->block[i];
   }
   brelse(buf);
-}
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
-static void
-write_head(void)
-{
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
+  sum = headsum(&log.lh);
   for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+    buf = bread(log.dev, log.start+i+1);
+    sum = cksum(sum, buf->data, BSIZE);
+    brelse(buf);
   }
-  bwrite(buf);
-  brelse(buf);
+  if (sum != log.lh.cksum)
+    log.lh.n = 0;  // torn by a crash
+  log.seq = log.lh.seq + 1;
 }
 
 static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(); // if committed, copy from log to disk
+  install_trans(1); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
 }
 
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
+  begin_op_n(MAXOPBLOCKS);
+}
+
+// begin_op() for a system call that writes at most n blocks;
+// n may be up to log_opmax().
+void
+begin_op_n(int n)
+{
+  struct proc *p = myproc();
+
+  if(n < 1 || n > log_opmax())
+    panic("begin_op_n");
   acquire(&log.lock);
   while(1){
-    if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    if(log.committing || log.want){
+      // let a waiting commit go first.
       sleep(&log, &log.lock);
+    } else if(log.lh.n + log.reserved + n > log.size){
+      // this op might exhaust log space; commit, or wait
+      // for the last outstanding op to.
+      if(log.outstanding == 0){
+        docommit();
+      } else {
+        log.want = 1;
+        sleep(&log, &log.lock);
+      }
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      p->logres = n;
       release(&log.lock);
       break;
     }
   }
 }
 
+// The most blocks one FS system call may reserve: half the
+// log, so that other calls can go on alongside it.
+int
+log_opmax(void)
+{
+  return log.size / 2 > MAXOPBLOCKS ? log.size / 2 : MAXOPBLOCKS;
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and someone is waiting for a commit.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= myproc()->logres;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 && log.want){
+    docommit();
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing log.reserved has decreased
     // the amount of reserved space.
     wakeup(&log);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Commit the running transaction. Caller must hold log.lock,
+// with no FS system calls outstanding; it is released while
+// committing.
+static void
+docommit(void)
+{
+  log.committing = 1;
+  log.want = 0;
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  release(&log.lock);
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  log.ncommit++;
+  wakeup(&log);
+}
+
+// Make the FS system calls that have finished so far
+// durable: commit them, and wait until that is done.
+// Must not be called inside a begin_op()/end_op().
+void
+log_sync(void)
+{
+  uint n;
+
+  acquire(&log.lock);
+  if(log.lh.n > 0 || log.committing){
+    // a commit in progress has every finished call, since
+    // no call can run during one; otherwise the next
+    // commit will.
+    n = log.ncommit + 1;
+    if(!log.committing){
+      if(log.outstanding == 0)
+        docommit();
+      else
+        log.want = 1;
+    }
+    while(log.ncommit < n)
+      sleep(&log, &log.lock);
+  }
+  release(&log.lock);
+}
+
+// The flusher thread: commit every COMMITTICKS, so that
+// finished calls don't wait long to reach the disk.
+static void
+flusher(void)
+{
+  uint t0;
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < COMMITTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+    log_sync();
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log, and write the header
+// along with the last batch of them. This is the true point at
+// which the current transaction commits.
 static void
 write_log(void)
 {
-  int tail;
+  struct buf *bs[LOGBATCH+1], *buf = &log.io[LOGBATCH];
+  struct logheader *hb = (struct logheader *) (buf->data);
+  uint sum;
+  int tail, i, m = 0;
 
+  log.lh.seq = log.seq;
+  sum = headsum(&log.lh);
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
+    struct buf *to = &log.io[m]; // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
     brelse(from);
-    brelse(to);
+    to->dev = log.dev;
+    to->blockno = log.start+tail+1;
+    sum = cksum(sum, to->data, BSIZE);
+    bs[m++] = to;
+    if (m == LOGBATCH && tail+1 < log.lh.n) {
+      virtio_disk_writev(bs, m);  // write the log
+      m = 0;
+    }
+  }
+  log.lh.cksum = sum;
+
+  hb->n = log.lh.n;
+  hb->seq = log.lh.seq;
+  hb->cksum = log.lh.cksum;
+  for (i = 0; i < log.lh.n; i++) {
+    hb->block[i] = log.lh.block[i];
   }
+  buf->dev = log.dev;
+  buf->blockno = log.start;
+  bs[m++] = buf;
+  virtio_disk_writev(bs, m);
 }
 
 static void
 commit()
 {
   if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    write_log();      // Write header and modified blocks to log -- the real commit
+    install_trans(0); // Now install writes to home locations
+    log.lh.n = 0;     // the next commit's header supersedes this one
+    log.seq++;
   }
 }
 
@@ -215,8 +393,6 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
@@ -225,6 +401,8 @@ log_write(struct buf *b)
     if (log.lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
+  if (i == log.lh.n && i >= log.size)
+    panic("too big a transaction");
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
@@ -11,14 +11,17 @@ void
 main()
 {
   if(cpuid() == 0){
+    uint64 t0 = r_time();
     consoleinit();
     printfinit();
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slabinit();      // small object allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    tlbinit();       // address-space IDs
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
@@ -26,9 +29,17 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
+    pcinit();        // page cache
     fileinit();      // file table
+    futexinit();     // futex wait queues
+    pollinit();      // poll() timeouts
+    timerqinit();    // nanosleep() queue
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
+    uint64 t1 = r_time();
+    printf("boot: kernel init took %dus, %dus since reset\n",
+           (int)((t1 - t0) / (MTIME_FREQ/1000000)),
+           (int)(t1 / (MTIME_FREQ/1000000)));
     __sync_synchronize();
     started = 1;
   } else {
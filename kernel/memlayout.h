@@ -29,6 +29,8 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define MTIME_FREQ 10000000L // CLINT_MTIME (and r_time()) cycles per second.
+#define TICK_INTERVAL (MTIME_FREQ/10) // cycles between timer interrupts (ticks).
 
 // qemu puts programmable interrupt controller here.
 #define PLIC 0x0c000000L
@@ -62,6 +64,21 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
-//   TRAPFRAME (p->trapframe, used by the trampoline)
+//   mmap() regions, growing down from MMAPTOP
+//   ...
+//   USYSCALL (read-only, shared with the kernel)
+//   TRAPFRAME(p) (proc[p].trapframe, used by the trampoline;
+//                 one for each of the threads sharing a page table)
 //   TRAMPOLINE (the same page as in the kernel)
-#define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define TRAPFRAME(p) (TRAMPOLINE - ((p)+1)*PGSIZE)
+
+// below room for the trapframes.
+#define USYSCALL (TRAMPOLINE - 1025*PGSIZE)
+#define MMAPTOP USYSCALL
+
+// What user code can learn at USYSCALL without a system call.
+struct usyscall {
+  int pid;      // for getpid(); 0 once threads share the page
+  uint64 freq;  // r_time() cycles per second, if user code may
+                // read the time CSR; else 0
+};
@@ -0,0 +1,34 @@
+// A region of user memory set up by mmap().
+struct vma {
+  uint64 addr;       // start, page-aligned
+  uint64 len;        // multiple of PGSIZE; 0 if the slot is free
+  int prot;          // PROT_ bits
+  int flags;         // MAP_ bits
+  struct file *f;    // mapped file, or 0 for zeroes
+  uint64 off;        // file offset of addr
+};
+
+// A segment of the running program, paged in from mm->exe
+// by execfault() as it is touched.
+struct seg {
+  uint64 va;         // start, page-aligned; memsz is 0 if unused
+  uint64 memsz;
+  uint64 off;        // file offset of va
+  uint64 filesz;     // bytes from the file; the rest are zeroes
+  int perm;          // PTE_R, PTE_W, PTE_X
+};
+
+// What is mapped in a process's page table, shared by all
+// its threads (see clone()). The lock is held while the
+// page table or the fields below are changed: by growproc(),
+// mmap(), munmap(), faults, and threads coming and going.
+struct mm {
+  struct sleeplock lock;
+  int ref;               // threads using it
+  uint64 sz;             // Size of process memory (bytes)
+  struct vma vma[NVMA];  // mmap()ed regions
+  struct inode *exe;     // Program file
+  struct seg seg[NSEG];  // its segments
+  uint64 swaphand;       // swapout()'s clock hand
+  uint64 asid;           // ASID, with its generation from bit 16 (see tlb.c)
+};
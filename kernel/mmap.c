@@ -0,0 +1,413 @@
+//
+// Memory-mapped files: mmap() and munmap().
+//
+// Each process has up to NVMA regions (p->mm->vma[]), placed top
+// down from MMAPTOP. Nothing is mapped by mmap() itself; the
+// pages of a region are filled in from the file when first
+// touched, by mmapfault(). File pages come from the page cache:
+// shared and read-only regions map the cached page itself,
+// private writable ones get a copy. A page of a MAP_SHARED
+// region is mapped read-only until it is first written, so
+// that pages with PTE_W set are exactly the ones that munmap()
+// and exit() must write back to the file.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+#include "mm.h"
+
+// Return the region of p that contains va, or 0.
+static struct vma*
+findvma(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Return a region of p that overlaps [a, a+len), or 0.
+static struct vma*
+overlap(struct proc *p, uint64 a, uint64 len)
+{
+  struct vma *v;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->len && a < v->addr + v->len && v->addr < a + len)
+      return v;
+  return 0;
+}
+
+// Lowest address used by p's regions; the heap
+// must stay below it.
+uint64
+mmapbase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = MMAPTOP;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->len && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Map len bytes of f starting at off, or zeroes if f is 0.
+// addr is a hint. Returns the address, or -1.
+uint64
+mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *free = 0;
+  uint64 a;
+
+  if(len == 0 || len > MMAPTOP || off % PGSIZE != 0)
+    return -1;
+  if((prot & ~(PROT_READ|PROT_WRITE|PROT_EXEC)) != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if(f){
+    if(f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+  len = PGROUNDUP(len);
+
+  acquiresleep(&p->mm->lock);
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->len == 0){
+      free = v;
+      break;
+    }
+  if(free == 0){
+    releasesleep(&p->mm->lock);
+    return -1;
+  }
+
+  // take the hint if it is usable, else search
+  // down from MMAPTOP for a hole.
+  if(addr % PGSIZE != 0 || addr < PGROUNDUP(p->mm->sz) ||
+     addr + len > MMAPTOP || addr + len < addr || overlap(p, addr, len)){
+    a = MMAPTOP - len;
+    while((v = overlap(p, a, len)) != 0){
+      a = v->addr - len;
+      if(a > MMAPTOP){
+        releasesleep(&p->mm->lock);
+        return -1;  // wrapped around
+      }
+    }
+    if(a < PGROUNDUP(p->mm->sz)){
+      releasesleep(&p->mm->lock);
+      return -1;
+    }
+    addr = a;
+  }
+
+  v = free;
+  v->addr = addr;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->off = off;
+  releasesleep(&p->mm->lock);
+  return addr;
+}
+
+// Write the page at va of shared region v back to its file,
+// without growing the file.
+static void
+writeback(struct vma *v, uint64 va, char *mem)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->addr);
+  uint n = PGSIZE;
+
+  begin_op_n(writeiblocks(PGSIZE));
+  ilock(ip);
+  if(off < ip->size){
+    if(off + n > ip->size)
+      n = ip->size - off;
+    writei(ip, 0, (uint64)mem, off, n);
+  }
+  iunlock(ip);
+  end_op();
+}
+
+// Unmap the pages of [a, a+len) in region v that have been
+// faulted in, writing back the written pages of a shared one.
+static void
+unmappages(struct proc *p, struct vma *v, uint64 a, uint64 len, int wb)
+{
+  pte_t *pte;
+  uint64 va;
+
+  if(wb && v->f && (v->flags & MAP_SHARED)){
+    for(va = a; va < a + len; va += PGSIZE){
+      if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V) && (*pte & PTE_W))
+        writeback(v, va, (char*)PTE2PA(*pte));
+    }
+  }
+  // all at once, so that other threads' TLBs are only
+  // waited for once.
+  uvmunmap(p->pagetable, a, len / PGSIZE, 1);
+}
+
+// Remove the mappings of [addr, addr+len). Regions that are
+// only partly covered shrink, or split in two.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+  uint64 a, e, end;
+  int nfree = 0;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr)
+    return -1;
+  end = addr + PGROUNDUP(len);
+
+  acquiresleep(&p->mm->lock);
+  // splitting a region needs a free slot.
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->len == 0)
+      nfree++;
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+    if(v->len && addr > v->addr && end < v->addr + v->len && nfree == 0){
+      releasesleep(&p->mm->lock);
+      return -1;
+    }
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->len == 0 || end <= v->addr || addr >= v->addr + v->len)
+      continue;
+    a = addr > v->addr ? addr : v->addr;
+    e = end < v->addr + v->len ? end : v->addr + v->len;
+    unmappages(p, v, a, e - a, 1);
+
+    if(a == v->addr && e == v->addr + v->len){
+      if(v->f)
+        fileclose(v->f);
+      v->len = 0;
+      v->f = 0;
+    } else if(a == v->addr){
+      v->off += e - v->addr;
+      v->len -= e - v->addr;
+      v->addr = e;
+    } else if(e == v->addr + v->len){
+      v->len = a - v->addr;
+    } else {
+      // a hole in the middle: the part above it
+      // becomes a new region.
+      for(nv = p->mm->vma; nv->len != 0; nv++)
+        ;
+      *nv = *v;
+      nv->addr = e;
+      nv->len = v->addr + v->len - e;
+      nv->off = v->off + (e - v->addr);
+      if(nv->f)
+        filedup(nv->f);
+      v->len = a - v->addr;
+    }
+  }
+  releasesleep(&p->mm->lock);
+  return 0;
+}
+
+// Remove all of p's regions, for exit() and exec(), when
+// no other thread is using them.
+void
+munmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    unmappages(p, v, v->addr, v->len, 1);
+    if(v->f)
+      fileclose(v->f);
+    v->len = 0;
+    v->f = 0;
+  }
+}
+
+// The PTE flags for a page of region v being faulted in for
+// perm. A page of a shared region stays read-only until it
+// is written.
+static int
+vmaperm(struct vma *v, int perm)
+{
+  int flags = PTE_U;
+
+  if(v->prot & PROT_READ)
+    flags |= PTE_R;
+  if(v->prot & PROT_EXEC)
+    flags |= PTE_X;
+  if((v->prot & PROT_WRITE) && (!(v->flags & MAP_SHARED) || perm == PTE_W))
+    flags |= PTE_W;
+  return flags;
+}
+
+// Give child np copies of p's regions, and of the pages
+// faulted in so far. Pages of shared regions, and pages that
+// can't be written, are shared rather than copied. A shared
+// region without a file has nothing else to find its pages
+// in, so they are all faulted in first, for both to share.
+// Returns 0 on success, -1 if out of memory, having undone
+// any copying.
+// Called from fork() with np->lock and p->mm->lock held, so
+// must not sleep.
+int
+mmapfork(struct proc *np, struct proc *p)
+{
+  struct vma *v;
+  uint64 a;
+  pte_t *pte;
+  char *mem;
+  int faulted = 0;
+
+  // (pages that can't be read or run can't be used anyway.)
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->len == 0 || v->f || !(v->flags & MAP_SHARED) ||
+       !(v->prot & (PROT_READ|PROT_EXEC)))
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_V))
+        continue;
+      if((mem = kalloc_zeroed()) == 0)
+        goto bad;
+      if(mappages(p->pagetable, a, PGSIZE, (uint64)mem, vmaperm(v, 0)) != 0){
+        kfree(mem);
+        goto bad;
+      }
+      faulted = 1;
+    }
+  }
+  if(faulted)
+    tlbinval(p->pagetable);  // as in uvmfault()
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if((v->flags & MAP_SHARED) || !(v->prot & PROT_WRITE)){
+        mem = (char*)PTE2PA(*pte);
+        kdup(mem);
+      } else if((mem = kalloc()) != 0){
+        memmove(mem, (char*)PTE2PA(*pte), PGSIZE);
+      } else {
+        goto bad;
+      }
+      if(mappages(np->pagetable, a, PGSIZE, (uint64)mem, PTE_FLAGS(*pte)) != 0){
+        kfree(mem);
+        goto bad;
+      }
+    }
+  }
+
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    np->mm->vma[v - p->mm->vma] = *v;
+    if(v->len && v->f)
+      filedup(v->f);
+  }
+  return 0;
+
+ bad:
+  for(v = p->mm->vma; v < &p->mm->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(np->pagetable, a, 0)) != 0 && (*pte & PTE_V))
+        uvmunmap(np->pagetable, a, 1, 1);
+    }
+  }
+  return -1;
+}
+
+// Handle a fault at va in pagetable, which needs one of
+// PTE_R, PTE_W or PTE_X: fill in the page from the region's
+// file, or let a shared page be written. Caller must hold
+// p->mm->lock.
+// Returns 0 if the access may be retried, -1 if it is an error.
+int
+mmapfault(pagetable_t pagetable, uint64 va, int perm)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  pte_t *pte;
+  char *mem, *cpg = 0;
+  uint64 off;
+
+  if(p == 0 || pagetable != p->pagetable || va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((v = findvma(p, va)) == 0)
+    return -1;
+  if((perm == PTE_R && !(v->prot & PROT_READ)) ||
+     (perm == PTE_W && !(v->prot & PROT_WRITE)) ||
+     (perm == PTE_X && !(v->prot & PROT_EXEC)))
+    return -1;
+
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    // the first write to a shared page.
+    if(perm != PTE_W)
+      return -1;
+    *pte |= PTE_W;
+    return 0;
+  }
+
+  // reading the file may sleep, which can't be done while
+  // holding a spinlock, as copyout() callers sometimes do.
+  if(v->f && !intr_get())
+    return -1;
+
+  mem = 0;
+  if(v->f){
+    off = v->off + (va - v->addr);
+    ilock_shared(v->f->ip);
+    if(off < v->f->ip->size && (cpg = pcmap(v->f->ip, off / PGSIZE)) == 0){
+      iunlock_shared(v->f->ip);
+      return -1;
+    }
+    iunlock_shared(v->f->ip);
+    if(cpg && ((v->flags & MAP_SHARED) || !(v->prot & PROT_WRITE))){
+      // map the page cache's page itself.
+      mem = cpg;
+    } else if(cpg){
+      // a private copy, to be written.
+      mem = kalloc();
+      if(mem)
+        memmove(mem, cpg, PGSIZE);
+      kfree(cpg);
+      if(mem == 0)
+        return -1;
+    }
+  }
+  // anonymous, or past the end of the file.
+  if(mem == 0 && (mem = kalloc_zeroed()) == 0)
+    return -1;
+
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, vmaperm(v, perm)) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
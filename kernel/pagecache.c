@@ -0,0 +1,336 @@
+// Page cache.
+//
+// Caches file contents a page (4096 bytes) at a time, keyed by
+// device, inode number and page offset in the file. readi()
+// reads through it; writei() still writes blocks through the
+// log, and copies what it writes into any cached page. Data
+// blocks read from disk to fill a page are released to the
+// cold end of the buffer cache, so that the buffer cache
+// mostly holds metadata and the log.
+//
+// mmap() maps the cached pages themselves. A page that is
+// mapped (its kalloc() reference count is above the cache's
+// own one) is never evicted, so that reads and writes of the
+// file keep seeing the mapped page.
+//
+// Eviction uses two lists. A new page goes on the inactive
+// list and only moves to the active list when it is used
+// again, which here means reading bytes of the page that were
+// read before; a sequential scan reads each page once, in
+// pieces, and so leaves the active list alone. Pages are
+// evicted from the old end of the inactive list first. The
+// active list is kept to at most half the cache.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCHASH 211
+#define HASH(dev, inum, pgoff) (((dev)*31 + (inum)*17 + (pgoff)) % NPCHASH)
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint pgoff;             // offset in the file, in pages
+  char *pa;               // the page; the cache holds one reference
+  int ref;                // users between pcget() and pcput()
+  int valid;              // has pa been read from disk?
+  int active;             // on the active list?
+  uint lastoff;           // end of the last read within the page
+  struct sleeplock lock;  // held while reading pa from disk
+  struct cpage *hnext;    // hash chain
+  struct cpage *prev;     // LRU list, active or inactive
+  struct cpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage *hash[NPCHASH];
+  struct cpage active;    // list heads; head.next is most recent
+  struct cpage inactive;
+  int n;                  // pages in the cache
+  int nactive;
+  uint64 hits;
+  uint64 misses;
+  struct kmem_cache *cache;
+} pcache;
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.active.next = pcache.active.prev = &pcache.active;
+  pcache.inactive.next = pcache.inactive.prev = &pcache.inactive;
+  pcache.cache = kmem_cache_create("cpage", sizeof(struct cpage));
+}
+
+static void
+listadd(struct cpage *head, struct cpage *cp)
+{
+  cp->next = head->next;
+  cp->prev = head;
+  head->next->prev = cp;
+  head->next = cp;
+}
+
+static void
+listdel(struct cpage *cp)
+{
+  cp->next->prev = cp->prev;
+  cp->prev->next = cp->next;
+}
+
+static void
+unhash(struct cpage *cp)
+{
+  struct cpage **pp;
+
+  pp = &pcache.hash[HASH(cp->dev, cp->inum, cp->pgoff)];
+  for(; *pp != cp; pp = &(*pp)->hnext)
+    ;
+  *pp = cp->hnext;
+}
+
+static struct cpage*
+lookup(uint dev, uint inum, uint pgoff)
+{
+  struct cpage *cp;
+
+  for(cp = pcache.hash[HASH(dev, inum, pgoff)]; cp; cp = cp->hnext)
+    if(cp->dev == dev && cp->inum == inum && cp->pgoff == pgoff)
+      return cp;
+  return 0;
+}
+
+// Note a read of bytes [o, o+m) of cp's page.
+// Caller must hold pcache.lock.
+static void
+touch(struct cpage *cp, uint o, uint m)
+{
+  struct cpage *old;
+
+  if(o < cp->lastoff){
+    // a second use.
+    listdel(cp);
+    if(!cp->active){
+      cp->active = 1;
+      pcache.nactive++;
+    }
+    listadd(&pcache.active, cp);
+    if(pcache.nactive > NPCACHE/2){
+      old = pcache.active.prev;
+      listdel(old);
+      old->active = 0;
+      pcache.nactive--;
+      listadd(&pcache.inactive, old);
+    }
+  }
+  cp->lastoff = o + m;
+}
+
+// Take the least valuable page that no one is using out of
+// the cache, to be reused. Caller must hold pcache.lock.
+static struct cpage*
+victim(void)
+{
+  struct cpage *cp;
+
+  for(cp = pcache.inactive.prev; cp != &pcache.inactive; cp = cp->prev)
+    if(cp->ref == 0 && krefcnt(cp->pa) == 1)
+      goto found;
+  for(cp = pcache.active.prev; cp != &pcache.active; cp = cp->prev)
+    if(cp->ref == 0 && krefcnt(cp->pa) == 1)
+      goto found;
+  return 0;
+
+ found:
+  listdel(cp);
+  if(cp->active)
+    pcache.nactive--;
+  unhash(cp);
+  return cp;
+}
+
+// Return the cached page pgoff of ip, reading it from disk if
+// need be, for a read of bytes [o, o+m) of it. The caller must
+// hold ip->lock (shared or exclusive), and must pcput() the page
+// when done. Returns 0 if there is no memory for the page.
+static struct cpage*
+pcget(struct inode *ip, uint pgoff, uint o, uint m)
+{
+  struct cpage *cp;
+  uint h = HASH(ip->dev, ip->inum, pgoff);
+
+  acquire(&pcache.lock);
+  if((cp = lookup(ip->dev, ip->inum, pgoff)) != 0){
+    cp->ref++;
+    pcache.hits++;
+    touch(cp, o, m);
+    release(&pcache.lock);
+  } else {
+    pcache.misses++;
+    if(pcache.n < NPCACHE && (cp = kmem_cache_alloc(pcache.cache)) != 0){
+      if((cp->pa = kalloc()) != 0){
+        initsleeplock(&cp->lock, "cpage");
+        pcache.n++;
+      } else {
+        kmem_cache_free(pcache.cache, cp);
+        cp = 0;
+      }
+    }
+    if(cp == 0 && (cp = victim()) == 0){
+      release(&pcache.lock);
+      return 0;
+    }
+    cp->dev = ip->dev;
+    cp->inum = ip->inum;
+    cp->pgoff = pgoff;
+    cp->ref = 1;
+    cp->valid = 0;
+    cp->active = 0;
+    cp->lastoff = o + m;
+    cp->hnext = pcache.hash[h];
+    pcache.hash[h] = cp;
+    listadd(&pcache.inactive, cp);
+    release(&pcache.lock);
+  }
+
+  acquiresleep(&cp->lock);
+  if(!cp->valid){
+    ireadpage(ip, pgoff, cp->pa);
+    cp->valid = 1;
+  }
+  releasesleep(&cp->lock);
+  return cp;
+}
+
+static void
+pcput(struct cpage *cp)
+{
+  acquire(&pcache.lock);
+  cp->ref--;
+  release(&pcache.lock);
+}
+
+// Copy n bytes at off of ip, which must be within the file,
+// to dst through the cache. Caller must hold ip->lock, shared
+// or exclusive. Returns the number of bytes copied.
+int
+pcread(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m, o;
+  struct cpage *cp;
+  int r;
+
+  for(tot = 0; tot < n; tot += m, off += m, dst += m){
+    o = off % PGSIZE;
+    m = min(n - tot, PGSIZE - o);
+    if((cp = pcget(ip, off / PGSIZE, o, m)) == 0)
+      break;
+    r = either_copyout(user_dst, dst, cp->pa + o, m);
+    pcput(cp);
+    if(r == -1)
+      break;
+  }
+  return tot;
+}
+
+// writei() wrote n bytes from src at off of ip: update the
+// cached copy, if any. Caller must hold ip->lock exclusively.
+void
+pcwrite(struct inode *ip, uint off, char *src, uint n)
+{
+  uint tot, m, o;
+  struct cpage *cp;
+
+  for(tot = 0; tot < n; tot += m, off += m, src += m){
+    o = off % PGSIZE;
+    m = min(n - tot, PGSIZE - o);
+    acquire(&pcache.lock);
+    if((cp = lookup(ip->dev, ip->inum, off / PGSIZE)) != 0)
+      cp->ref++;
+    release(&pcache.lock);
+    if(cp){
+      memmove(cp->pa + o, src, m);
+      pcput(cp);
+    }
+  }
+}
+
+// Return page pgoff of ip for mmap(), with a reference for the
+// caller to kfree(). Returns 0 if the page is past the end of
+// the file or there is no memory. Caller must hold ip->lock,
+// shared or exclusive.
+void*
+pcmap(struct inode *ip, uint pgoff)
+{
+  struct cpage *cp;
+  char *pa;
+
+  if((uint64)pgoff * PGSIZE >= ip->size)
+    return 0;
+  if((cp = pcget(ip, pgoff, 0, PGSIZE)) == 0)
+    return 0;
+  pa = cp->pa;
+  kdup(pa);
+  pcput(cp);
+  return pa;
+}
+
+// Drop ip's pages from the cache, because its contents are
+// going away. Pages still mapped stay with their mappings.
+// Caller must hold ip->lock exclusively.
+void
+pcinval(struct inode *ip)
+{
+  struct cpage *cp;
+  uint pgoff;
+
+  acquire(&pcache.lock);
+  for(pgoff = 0; (uint64)pgoff * PGSIZE < ip->size; pgoff++){
+    if((cp = lookup(ip->dev, ip->inum, pgoff)) == 0)
+      continue;
+    if(cp->ref != 0)
+      panic("pcinval");
+    unhash(cp);
+    listdel(cp);
+    if(cp->active)
+      pcache.nactive--;
+    pcache.n--;
+    kfree(cp->pa);
+    kmem_cache_free(pcache.cache, cp);
+  }
+  release(&pcache.lock);
+}
+
+// Give one unused page of the cache back to kalloc(), when
+// memory is short. Returns 1 if a page was freed, 0 if not.
+int
+pcshrink(void)
+{
+  struct cpage *cp;
+
+  acquire(&pcache.lock);
+  if((cp = victim()) != 0)
+    pcache.n--;
+  release(&pcache.lock);
+  if(cp == 0)
+    return 0;
+  kfree(cp->pa);
+  kmem_cache_free(pcache.cache, cp);
+  return 1;
+}
+
+// Print cache statistics. For ^P; doesn't take pcache.lock.
+void
+pcdump(void)
+{
+  printf("pcache: %d pages, %d active, %d hits, %d misses\n",
+         pcache.n, pcache.nactive, (int)pcache.hits, (int)pcache.misses);
+}
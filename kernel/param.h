@@ -1,13 +1,19 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // mmap() regions per process
+#define NSEG         4   // program segments exec() pages in per process
+#define NINODE       50  // unused i-nodes kept in the inode cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXSPAWNACT  16  // max file actions per spawn()
+#define MAXIOV       16  // max buffers per readv() or writev()
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      128  // blocks in the on-disk log mkfs makes
+#define NBUF         (MAXOPBLOCKS*3)  // initial size of disk block cache
+#define NPCACHE      2048  // max pages in the file page cache
+#define FSSIZE       2000  // size of file system in blocks
+#define NSWAP        8192  // size of swap area after the file system, in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER     10    // largest kalloc_order() block is 2^MAXORDER pages
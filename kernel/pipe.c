@@ -7,6 +7,7 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
 #define PIPESIZE 512
 
@@ -17,6 +18,7 @@ struct pipe {
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct pollent *pollq;  // poll()s waiting on the pipe
 };
 
 int
@@ -28,12 +30,13 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = (struct pipe*)kmalloc(sizeof(*pi))) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->pollq = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +50,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmfree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -66,62 +69,108 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwake(&pi->pollq);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kmfree(pi);
   } else
     release(&pi->lock);
 }
 
+// Write n bytes from addr, a user address if user_src is
+// set and a kernel one otherwise, into pi. If nonblock is
+// set, write only what fits, failing if nothing does.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n, int nonblock)
 {
-  int i;
-  char ch;
+  int i, m;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
-  for(i = 0; i < n; i++){
+  for(i = 0; i < n; i += m){
     while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(pi->readopen == 0 || pr->killed){
+      if(pi->readopen == 0 || pr->killed || (nonblock && i == 0)){
         release(&pi->lock);
         return -1;
       }
+      if(nonblock)
+        goto out;
       wakeup(&pi->nread);
+      pollwake(&pi->pollq);
       sleep(&pi->nwrite, &pi->lock);
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+    // as much as fits before the free space wraps around.
+    m = n - i;
+    if(m > pi->nread + PIPESIZE - pi->nwrite)
+      m = pi->nread + PIPESIZE - pi->nwrite;
+    if(m > PIPESIZE - pi->nwrite % PIPESIZE)
+      m = PIPESIZE - pi->nwrite % PIPESIZE;
+    if(either_copyin(&pi->data[pi->nwrite % PIPESIZE], user_src, addr + i, m) == -1)
       break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    pi->nwrite += m;
   }
+ out:
   wakeup(&pi->nread);
+  pollwake(&pi->pollq);
   release(&pi->lock);
   return i;
 }
 
+// Read up to n bytes from pi into addr, a user address if
+// user_dst is set and a kernel one otherwise. If nonblock is
+// set, fail rather than wait for a writer.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, int user_dst, uint64 addr, int n, int nonblock)
 {
-  int i;
+  int i, m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(pr->killed){
+    if(pr->killed || nonblock){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    m = n - i;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > PIPESIZE - pi->nread % PIPESIZE)
+      m = PIPESIZE - pi->nread % PIPESIZE;
+    if(either_copyout(user_dst, addr + i, &pi->data[pi->nread % PIPESIZE], m) == -1)
       break;
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pollwake(&pi->pollq);
   release(&pi->lock);
   return i;
 }
+
+// Which of POLLIN, POLLOUT and POLLHUP apply to pi's read end,
+// or its write end if writable is set. If none of events do,
+// queue e to be woken when that changes. See poll.c.
+int
+pipepoll(struct pipe *pi, int writable, int events, struct pollent *e)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  if(writable){
+    if(pi->readopen == 0)
+      r |= POLLHUP;
+    else if(pi->nwrite != pi->nread + PIPESIZE)
+      r |= events & POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      r |= events & POLLIN;
+    if(pi->writeopen == 0)
+      r |= POLLHUP;
+  }
+  if(r == 0 && e)
+    pollqueue(&pi->pollq, &pi->lock, e);
+  release(&pi->lock);
+  return r;
+}
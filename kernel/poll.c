@@ -0,0 +1,192 @@
+// poll(): waiting for any of several files at once.
+//
+// Pipes and the console keep a wait queue of pollents, one
+// for each poll() that is waiting on them, protected by
+// their own lock. poll() checks each file in turn, queueing
+// a pollent on every one that isn't ready while still holding
+// its lock, and then sleeps until one of them calls
+// pollwake(), or the timeout runs out. Because the check and
+// the queueing happen under the file's lock, a change
+// between them can't be missed.
+//
+// pollwake() doesn't dequeue anything; each poll() takes its
+// own pollents off the queues on the way out.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+#include "poll.h"
+
+// One poll() call, on its kernel stack.
+struct pollwait {
+  int woken;              // a file is ready, or time is up
+  uint deadline;          // in ticks, if timed
+  struct pollwait *next;  // on the timed list
+};
+
+// A poll() waiting on one file.
+struct pollent {
+  struct pollent *next;
+  struct pollent **q;     // the queue it is on, or 0
+  struct spinlock *lk;    // the lock that protects q
+  struct pollwait *w;
+};
+
+struct {
+  struct spinlock lock;   // protects woken, and the timed list
+  struct pollwait *timed; // poll()s with a timeout
+} polls;
+
+void
+pollinit(void)
+{
+  initlock(&polls.lock, "poll");
+}
+
+// Put e on wait queue q, protected by lk, which the caller
+// holds, to be woken when the file changes.
+void
+pollqueue(struct pollent **q, struct spinlock *lk, struct pollent *e)
+{
+  e->q = q;
+  e->lk = lk;
+  e->next = *q;
+  *q = e;
+}
+
+// Wake every poll() on queue q. Caller holds q's lock.
+void
+pollwake(struct pollent **q)
+{
+  struct pollent *e;
+
+  for(e = *q; e; e = e->next){
+    acquire(&polls.lock);
+    e->w->woken = 1;
+    wakeup(e->w);
+    release(&polls.lock);
+  }
+}
+
+// Wake poll()s whose timeout has run out. Called by
+// clockintr() after each tick.
+void
+polltick(void)
+{
+  struct pollwait *w;
+
+  acquire(&polls.lock);
+  for(w = polls.timed; w; w = w->next){
+    if(!w->woken && (int)(ticks - w->deadline) >= 0){
+      w->woken = 1;
+      wakeup(w);
+    }
+  }
+  release(&polls.lock);
+}
+
+static void
+dequeue(struct pollent *e)
+{
+  struct pollent **pp;
+
+  if(e->q == 0)
+    return;
+  acquire(e->lk);
+  for(pp = e->q; *pp != e; pp = &(*pp)->next)
+    ;
+  *pp = e->next;
+  release(e->lk);
+  e->q = 0;
+}
+
+// Wait until one of the n files in the user array fds is
+// ready for what its events ask, or for timeout ticks if
+// timeout isn't -1. Returns the number of fds with something
+// to report in revents, 0 on timeout, or -1.
+int
+poll(uint64 fds, int n, int timeout)
+{
+  struct proc *p = myproc();
+  struct pollfd pfd[NPOLL];
+  struct pollent ent[NPOLL];
+  struct file *f[NPOLL];
+  struct pollwait w, **wp;
+  int i, nready = 0;
+
+  if(n < 0 || n > NPOLL || timeout < -1)
+    return -1;
+  if(copyin(p->pagetable, (char*)pfd, fds, n*sizeof(pfd[0])) < 0)
+    return -1;
+
+  w.woken = 0;
+  w.deadline = ticks + timeout;
+  if(timeout > 0){
+    acquire(&polls.lock);
+    w.next = polls.timed;
+    polls.timed = &w;
+    release(&polls.lock);
+  }
+
+  // hold on to the files, in case another thread closes them.
+  acquire(&p->fdt->lock);
+  for(i = 0; i < n; i++){
+    f[i] = 0;
+    if(pfd[i].fd >= 0 && pfd[i].fd < NOFILE && p->fdt->ofile[pfd[i].fd])
+      f[i] = filedup(p->fdt->ofile[pfd[i].fd]);
+  }
+  release(&p->fdt->lock);
+
+  for(;;){
+    // check every file, queueing on those that aren't ready
+    // until one is.
+    for(i = 0; i < n; i++){
+      ent[i].q = 0;
+      ent[i].w = &w;
+      if(f[i] == 0)
+        pfd[i].revents = POLLNVAL;
+      else
+        pfd[i].revents = filepoll(f[i], pfd[i].events, nready ? 0 : &ent[i]);
+      if(pfd[i].revents)
+        nready++;
+    }
+    if(nready > 0 || timeout == 0)
+      break;
+
+    acquire(&polls.lock);
+    while(!w.woken && !p->killed)
+      sleep(&w, &polls.lock);
+    w.woken = 0;
+    release(&polls.lock);
+
+    for(i = 0; i < n; i++)
+      dequeue(&ent[i]);
+    if(p->killed || (timeout > 0 && (int)(ticks - w.deadline) >= 0))
+      break;
+  }
+
+  for(i = 0; i < n; i++){
+    dequeue(&ent[i]);
+    if(f[i])
+      fileclose(f[i]);
+  }
+  if(timeout > 0){
+    acquire(&polls.lock);
+    for(wp = &polls.timed; *wp != &w; wp = &(*wp)->next)
+      ;
+    *wp = w.next;
+    release(&polls.lock);
+  }
+
+  if(p->killed)
+    return -1;
+  if(copyout(p->pagetable, fds, (char*)pfd, n*sizeof(pfd[0])) < 0)
+    return -1;
+  return nready;
+}
@@ -0,0 +1,13 @@
+// poll() asks about each of an array of these.
+struct pollfd {
+  int fd;
+  short events;   // what to wait for
+  short revents;  // what happened; set by poll()
+};
+
+#define POLLIN   0x01  // can read without blocking
+#define POLLOUT  0x04  // can write without blocking
+#define POLLHUP  0x10  // other end of a pipe closed
+#define POLLNVAL 0x20  // fd isn't open
+
+#define NPOLL 16  // max fds per poll()
@@ -4,6 +4,10 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
+#include "mm.h"
+#include "procinfo.h"
+#include "spawn.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
@@ -15,7 +19,12 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+struct kmem_cache *mmcache;   // where struct mms come from
+struct kmem_cache *fdtcache;  // and struct fdtables
+
 extern void forkret(void);
+static void spawnret(void);
+static void kthreadret(void);
 static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
 
@@ -28,8 +37,11 @@ procinit(void)
   struct proc *p;
   
   initlock(&pid_lock, "nextpid");
+  mmcache = kmem_cache_create("mm", sizeof(struct mm));
+  fdtcache = kmem_cache_create("fdtable", sizeof(struct fdtable));
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
+      p->trapva = TRAPFRAME((int) (p - proc));
 
       // Allocate a page for the process's kernel stack.
       // Map it high in memory, followed by an invalid
@@ -86,25 +98,37 @@ allocpid() {
 }
 
 // Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// If found, return it with p->lock held, else 0.
 static struct proc*
-allocproc(void)
+unusedproc(void)
 {
   struct proc *p;
 
   for(p = proc; p < &proc[NPROC]; p++) {
     acquire(&p->lock);
     if(p->state == UNUSED) {
-      goto found;
+      return p;
     } else {
       release(&p->lock);
     }
   }
   return 0;
+}
+
+// Look in the process table for an UNUSED proc.
+// If found, initialize state required to run in the kernel,
+// and return with p->lock held.
+// If tp is 0, the new proc gets empty memory and no open files;
+// otherwise it is a thread sharing tp's, and the caller must
+// hold tp->mm->lock.
+// If there are no free procs, or a memory allocation fails, return 0.
+static struct proc*
+allocproc(struct proc *tp)
+{
+  struct proc *p;
 
-found:
+  if((p = unusedproc()) == 0)
+    return 0;
   p->pid = allocpid();
 
   // Allocate a trapframe page.
@@ -113,12 +137,46 @@ found:
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
+  if(tp){
+    // map the new trapframe into the shared page table.
+    if(mappages(tp->pagetable, p->trapva, PGSIZE,
+                (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    p->pagetable = tp->pagetable;
+    tlbinval(p->pagetable); // in case a TLB holds the old, invalid PTE
+    // getpid() can no longer come from the shared page.
+    ((struct usyscall*)walkaddr(p->pagetable, USYSCALL))->pid = 0;
+    p->mm = tp->mm;
+    p->mm->ref++;
+    p->fdt = tp->fdt;
+    acquire(&p->fdt->lock);
+    p->fdt->ref++;
+    release(&p->fdt->lock);
+  } else {
+    p->mm = kmem_cache_alloc(mmcache);
+    p->fdt = kmem_cache_alloc(fdtcache);
+    if(p->mm == 0 || p->fdt == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    memset(p->mm, 0, sizeof(*p->mm));
+    initsleeplock(&p->mm->lock, "mm");
+    p->mm->ref = 1;
+    memset(p->fdt, 0, sizeof(*p->fdt));
+    initlock(&p->fdt->lock, "fdtable");
+    p->fdt->ref = 1;
+
+    // An empty user page table.
+    p->pagetable = proc_pagetable(p);
+    if(p->pagetable == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
   }
 
   // Set up new context to start executing at forkret,
@@ -127,11 +185,16 @@ found:
   p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
 
+  p->utime = 0;
+  p->stime = 0;
+
   return p;
 }
 
-// free a proc structure and the data hanging from it,
-// including user pages.
+// free a proc structure and the data hanging from it.
+// exit() gives up the memory and files, so the only ones
+// left here are those of a proc that never ran, which are
+// its own, and have nothing in them but user pages.
 // p->lock must be held.
 static void
 freeproc(struct proc *p)
@@ -140,9 +203,16 @@ freeproc(struct proc *p)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
   if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
+    proc_freepagetable(p, p->pagetable, p->mm->sz);
   p->pagetable = 0;
-  p->sz = 0;
+  if(p->mm)
+    kmem_cache_free(mmcache, p->mm);
+  p->mm = 0;
+  if(p->fdt)
+    kmem_cache_free(fdtcache, p->fdt);
+  p->fdt = 0;
+  p->thread = 0;
+  p->ring = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -158,6 +228,7 @@ pagetable_t
 proc_pagetable(struct proc *p)
 {
   pagetable_t pagetable;
+  struct usyscall *u;
 
   // An empty page table.
   pagetable = uvmcreate();
@@ -174,24 +245,39 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-  // map the trapframe just below TRAMPOLINE, for trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE,
+  // map the trapframe below TRAMPOLINE, for trampoline.S.
+  if(mappages(pagetable, p->trapva, PGSIZE,
               (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
     return 0;
   }
 
+  // and the page of things user code may read directly.
+  if((u = kalloc_zeroed()) == 0 ||
+     mappages(pagetable, USYSCALL, PGSIZE, (uint64)u, PTE_R | PTE_U) < 0){
+    if(u)
+      kfree(u);
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, p->trapva, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+  u->pid = p->pid;
+  u->freq = MTIME_FREQ;
+
   return pagetable;
 }
 
 // Free a process's page table, and free the
 // physical memory it refers to.
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+proc_freepagetable(struct proc *p, pagetable_t pagetable, uint64 sz)
 {
+  asidfree(pagetable);
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, p->trapva, 1, 0);
+  uvmunmap(pagetable, USYSCALL, 1, 1);
   uvmfree(pagetable, sz);
 }
 
@@ -213,44 +299,85 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->mm->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
   p->trapframe->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  p->fdt->cwd = namei("/");
 
   p->state = RUNNABLE;
 
   release(&p->lock);
 }
 
+// Start a kernel thread: a process that stays in the kernel,
+// running fn(), which must not return. It has no user memory,
+// trapframe, files, parent or pid; kill() can't reach it.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = unusedproc()) == 0)
+    panic("kthread");
+  p->kfn = fn;
+  memset(&p->context, 0, sizeof(p->context));
+  p->context.ra = (uint64)kthreadret;
+  p->context.sp = p->kstack + PGSIZE;
+  p->utime = 0;
+  p->stime = 0;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Return the old size, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint sz;
+  uint64 sz, oldsz;
   struct proc *p = myproc();
+  struct mm *mm = p->mm;
 
-  sz = p->sz;
+  acquiresleep(&mm->lock);
+  sz = oldsz = mm->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if(sz + n > mmapbase(p) ||
+       (sz = uvmalloc(p->pagetable, sz, sz + n)) == 0){
+      releasesleep(&mm->lock);
       return -1;
     }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if((sz = uvmdealloc(p->pagetable, sz, sz + n)) == oldsz){
+      releasesleep(&mm->lock);
+      return -1;
+    }
   }
-  p->sz = sz;
-  return 0;
+  mm->sz = sz;
+  releasesleep(&mm->lock);
+  return oldsz;
+}
+
+// Give np copies of p's open files and current directory.
+static void
+fdtcopy(struct proc *np, struct proc *p)
+{
+  acquire(&p->fdt->lock);
+  for(int i = 0; i < NOFILE; i++)
+    if(p->fdt->ofile[i])
+      np->fdt->ofile[i] = filedup(p->fdt->ofile[i]);
+  np->fdt->cwd = idup(p->fdt->cwd);
+  release(&p->fdt->lock);
 }
 
 // Create a new process, copying the parent.
@@ -258,22 +385,41 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct mm *mm = p->mm;
 
-  // Allocate process.
-  if((np = allocproc()) == 0){
-    return -1;
+  // keep other threads from changing memory while it's copied.
+  acquiresleep(&mm->lock);
+  for(;;){
+    // Allocate process.
+    if((np = allocproc(0)) == 0){
+      releasesleep(&mm->lock);
+      return -1;
+    }
+
+    // Copy user memory from parent to child.
+    if(uvmcopy(p->pagetable, np->pagetable, mm->sz) == 0)
+      break;
+    freeproc(np);
+    release(&np->lock);
+
+    // out of memory; make room and try again. can't be
+    // done above, holding np->lock.
+    if(reclaim(PGROUNDUP(mm->sz) / PGSIZE) == 0){
+      releasesleep(&mm->lock);
+      return -1;
+    }
   }
+  np->mm->sz = mm->sz;
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  if(mmapfork(np, p) < 0){
     freeproc(np);
     release(&np->lock);
+    releasesleep(&mm->lock);
     return -1;
   }
-  np->sz = p->sz;
 
   np->parent = p;
 
@@ -284,10 +430,12 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+  fdtcopy(np, p);
+  np->mm->exe = mm->exe ? idup(mm->exe) : 0;
+  if(np->mm->exe)
+    iexecget(np->mm->exe);  // can't fail; p's mm already counts
+  memmove(np->mm->seg, mm->seg, sizeof(mm->seg));
+  np->ring = p->ring;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -296,10 +444,150 @@ fork(void)
   np->state = RUNNABLE;
 
   release(&np->lock);
+  releasesleep(&mm->lock);
 
   return pid;
 }
 
+// Create a new thread in the current process, sharing its
+// memory, open files and current directory, to run fn(arg)
+// on the user stack whose top is sp. fn must not return;
+// the thread ends with exit(), and join() waits for it.
+// Returns the new thread's pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 sp)
+{
+  int pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if(sp % 16 != 0)
+    return -1;
+
+  acquiresleep(&p->mm->lock);
+  if((np = allocproc(p)) == 0){
+    releasesleep(&p->mm->lock);
+    return -1;
+  }
+
+  // the caller's registers, gp and tp included, but
+  // starting at fn.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = sp;
+  np->trapframe->a0 = arg;
+  np->trapframe->ra = 0;
+
+  np->parent = p;
+  np->thread = 1;
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  pid = np->pid;
+  np->state = RUNNABLE;
+
+  release(&np->lock);
+  releasesleep(&p->mm->lock);
+
+  return pid;
+}
+
+// What a spawn()ed process is to do, on its parent's stack.
+struct spawnreq {
+  char *path;
+  char **argv;
+  struct spawnact *act;
+  int nact;
+  int done;  // child has exec()ed, or failed to
+  int err;
+};
+
+// Create a new process running path with argv, without
+// copying the caller's memory. The child starts out with the
+// caller's open files and current directory, applies the file
+// actions in act, and exec()s. The caller waits until the
+// exec() is over, so that it can report failure.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct spawnact *act, int nact)
+{
+  int pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct spawnreq req;
+
+  if((np = allocproc(0)) == 0){
+    return -1;
+  }
+
+  req.path = path;
+  req.argv = argv;
+  req.act = act;
+  req.nact = nact;
+  req.done = 0;
+  req.err = 0;
+  np->spawn = &req;
+  np->context.ra = (uint64)spawnret;
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+
+  np->parent = p;
+  fdtcopy(np, p);
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  pid = np->pid;
+  np->state = RUNNABLE;
+
+  while(!req.done)
+    sleep(&req, &np->lock);
+  release(&np->lock);
+  if(!req.err)
+    return pid;
+
+  // the child is exiting; reap it, as wait() would.
+  acquire(&p->lock);
+  for(;;){
+    acquire(&np->lock);
+    if(np->state == ZOMBIE){
+      freeproc(np);
+      release(&np->lock);
+      break;
+    }
+    release(&np->lock);
+    sleep(p, &p->lock);
+  }
+  release(&p->lock);
+  return -1;
+}
+
+// Apply spawn() file actions to p's descriptors.
+static int
+spawnfds(struct proc *p, struct spawnact *act, int nact)
+{
+  struct spawnact *a;
+
+  for(a = act; a < &act[nact]; a++){
+    if(a->fd < 0 || a->fd >= NOFILE)
+      return -1;
+    switch(a->op){
+    case SPAWN_CLOSE:
+      if(p->fdt->ofile[a->fd]){
+        fileclose(p->fdt->ofile[a->fd]);
+        p->fdt->ofile[a->fd] = 0;
+      }
+      break;
+    case SPAWN_DUP2:
+      if(a->newfd < 0 || a->newfd >= NOFILE || p->fdt->ofile[a->fd] == 0)
+        return -1;
+      if(a->newfd == a->fd)
+        break;
+      if(p->fdt->ofile[a->newfd])
+        fileclose(p->fdt->ofile[a->newfd]);
+      p->fdt->ofile[a->newfd] = filedup(p->fdt->ofile[a->fd]);
+      break;
+    default:
+      return -1;
+    }
+  }
+  return 0;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold p->lock.
 void
@@ -317,6 +605,8 @@ reparent(struct proc *p)
       // because only the parent changes it, and we're the parent.
       acquire(&pp->lock);
       pp->parent = initproc;
+      // an orphaned thread is just another child to init.
+      pp->thread = 0;
       // we should wake up init here, but that would require
       // initproc->lock, which would be a deadlock, since we hold
       // the lock on one of init's children (pp). this is why
@@ -326,30 +616,88 @@ reparent(struct proc *p)
   }
 }
 
-// Exit the current process.  Does not return.
-// An exited process remains in the zombie state
-// until its parent calls wait().
-void
-exit(int status)
+// Give up p's share of its memory. The last thread to go
+// unmaps everything and frees the page table.
+static void
+mmput(struct proc *p)
 {
-  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+  pagetable_t pagetable = p->pagetable;
+  int last;
+
+  acquiresleep(&mm->lock);
+  last = --mm->ref == 0;
+  if(!last)
+    uvmunmap(pagetable, p->trapva, 1, 0);
+  releasesleep(&mm->lock);
+
+  if(last){
+    munmapall(p);
+    if(mm->exe){
+      iexecput(mm->exe);
+      begin_op();
+      iput(mm->exe);
+      end_op();
+    }
+  }
 
-  if(p == initproc)
-    panic("init exiting");
+  // procinfo() looks at p->mm.
+  acquire(&p->lock);
+  p->mm = 0;
+  p->pagetable = 0;
+  release(&p->lock);
+
+  if(last){
+    proc_freepagetable(p, pagetable, mm->sz);
+    kmem_cache_free(mmcache, mm);
+  }
+}
+
+// Give up p's share of its open files and current directory.
+// The last thread to go closes them.
+static void
+fdtput(struct proc *p)
+{
+  struct fdtable *fdt = p->fdt;
+  int last;
+
+  acquire(&fdt->lock);
+  last = --fdt->ref == 0;
+  release(&fdt->lock);
+  p->fdt = 0;
+  if(!last)
+    return;
 
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
+    if(fdt->ofile[fd]){
+      struct file *f = fdt->ofile[fd];
       fileclose(f);
-      p->ofile[fd] = 0;
+      fdt->ofile[fd] = 0;
     }
   }
 
   begin_op();
-  iput(p->cwd);
+  iput(fdt->cwd);
   end_op();
-  p->cwd = 0;
+  kmem_cache_free(fdtcache, fdt);
+}
+
+// Exit the current process, or thread.  Does not return.
+// An exited process remains in the zombie state
+// until its parent calls wait(), or join() for a thread.
+// The memory and files shared by a process's threads go
+// away with the last of them.
+void
+exit(int status)
+{
+  struct proc *p = myproc();
+
+  if(p == initproc)
+    panic("init exiting");
+
+  mmput(p);
+  fdtput(p);
 
   // we might re-parent a child to init. we can't be precise about
   // waking up init, since we can't acquire its lock once we've
@@ -392,13 +740,14 @@ exit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr)
+// Wait for a child to exit and return its pid: a process if
+// thread is 0, else a thread, and if pid is not 0, only that
+// one. Return -1 if there is no such child.
+static int
+reap(int pid, int thread, uint64 addr)
 {
   struct proc *np;
-  int havekids, pid;
+  int havekids, xstate;
   struct proc *p = myproc();
 
   // hold p->lock for the whole time to avoid lost
@@ -416,19 +765,23 @@ wait(uint64 addr)
         // np->parent can't change between the check and the acquire()
         // because only the parent changes it, and we're the parent.
         acquire(&np->lock);
+        if(np->thread != thread || (pid != 0 && np->pid != pid)){
+          release(&np->lock);
+          continue;
+        }
         havekids = 1;
         if(np->state == ZOMBIE){
           // Found one.
           pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
-            return -1;
-          }
+          xstate = np->xstate;
           freeproc(np);
           release(&np->lock);
           release(&p->lock);
+          // copy out without the locks, since addr's page
+          // may have to be swapped in.
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
+            return -1;
           return pid;
         }
         release(&np->lock);
@@ -446,6 +799,24 @@ wait(uint64 addr)
   }
 }
 
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(uint64 addr)
+{
+  return reap(0, 0, addr);
+}
+
+// Wait for thread tid, made by this thread with clone(), to
+// exit, and return tid. Return -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  if(tid <= 0)
+    return -1;
+  return reap(tid, 1, addr);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -467,25 +838,38 @@ scheduler(void)
     int found = 0;
     for(p = proc; p < &proc[NPROC]; p++) {
       acquire(&p->lock);
-      if(p->state == RUNNABLE) {
+      if(p->state == RUNNABLE && !p->swapbusy) {
         // Switch to chosen process.  It is the process's job
         // to release its lock and then reacquire it
         // before jumping back to us.
         p->state = RUNNING;
         c->proc = p;
+        uint64 start = r_time();
+        p->tstamp = start;
         swtch(&c->context, &p->context);
 
         // Process is done running for now.
         // It should have changed its p->state before coming back.
+        // it always gives up the CPU from the kernel, so the time
+        // since its last transition was system time.
+        uint64 now = r_time();
+        p->stime += now - p->tstamp;
+        c->busy += now - start;
         c->proc = 0;
+        tlbpass();
 
         found = 1;
       }
       release(&p->lock);
     }
     if(found == 0) {
+      // nothing to run; use the time to zero a free page.
+      if(kzeropage())
+        continue;
       intr_on();
+      uint64 start = r_time();
       asm volatile("wfi");
+      c->idle += r_time() - start;
     }
   }
 }
@@ -549,6 +933,49 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
+// A spawn() child's very first scheduling by scheduler()
+// will swtch to spawnret, to set up its files and exec().
+static void
+spawnret(void)
+{
+  struct proc *p = myproc();
+  struct spawnreq *req = p->spawn;
+  int r = -1;
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  if(spawnfds(p, req->act, req->nact) == 0)
+    r = exec(req->path, req->argv);
+  p->spawn = 0;
+
+  // tell the parent, which may then return and free *req.
+  acquire(&p->lock);
+  req->err = r < 0;
+  req->done = 1;
+  release(&p->lock);
+  wakeup(req);
+
+  if(r < 0)
+    exit(-1);
+  p->trapframe->a0 = r;  // argc, as from exec()
+  usertrapret();
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -619,6 +1046,8 @@ kill(int pid)
 {
   struct proc *p;
 
+  if(pid <= 0)
+    return -1;  // unused procs and kernel threads
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
     if(p->pid == pid){
@@ -690,6 +1119,51 @@ procdump(void)
     else
       state = "???";
     printf("%d %s %s", p->pid, state, p->name);
+    printf(" user %dms sys %dms", (int)(p->utime / (MTIME_FREQ/1000)),
+           (int)(p->stime / (MTIME_FREQ/1000)));
     printf("\n");
   }
 }
+
+// Copy statistics for up to npi processes to the user array
+// at addr, and for up to nhi harts to the user array at haddr.
+// Returns the number of processes copied, or -1 on error.
+int
+procinfo(uint64 addr, int npi, uint64 haddr, int nhi)
+{
+  struct proc *p, *pp;
+  struct procinfo pi;
+  struct hartinfo hi;
+  int n = 0;
+
+  pp = myproc();
+  for(p = proc; p < &proc[NPROC] && n < npi; p++){
+    acquire(&p->lock);
+    if(p->state == UNUSED){
+      release(&p->lock);
+      continue;
+    }
+    pi.pid = p->pid;
+    // p->parent is stable only under the parent's lock,
+    // but a stale ppid is harmless here.
+    pi.ppid = p->parent ? p->parent->pid : 0;
+    pi.state = p->state;
+    pi.sz = p->mm ? p->mm->sz : 0;
+    pi.utime = p->utime;
+    pi.stime = p->stime;
+    safestrcpy(pi.name, p->name, sizeof(pi.name));
+    release(&p->lock);
+    if(copyout(pp->pagetable, addr + n*sizeof(pi), (char *)&pi, sizeof(pi)) < 0)
+      return -1;
+    n++;
+  }
+
+  for(int i = 0; i < NCPU && i < nhi; i++){
+    hi.busy = cpus[i].busy;
+    hi.idle = cpus[i].idle;
+    if(copyout(pp->pagetable, haddr + i*sizeof(hi), (char *)&hi, sizeof(hi)) < 0)
+      return -1;
+  }
+
+  return n;
+}
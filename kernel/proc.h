@@ -24,13 +24,17 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 busy;                // r_time() cycles spent running processes.
+  uint64 idle;                // r_time() cycles spent idle in wfi.
 };
 
 extern struct cpu cpus[NCPU];
 
 // per-process data for the trap handling code in trampoline.S.
-// sits in a page by itself just under the trampoline page in the
-// user page table. not specially mapped in the kernel page table.
+// sits in a page by itself under the trampoline page in the
+// user page table, at p->trapva, so that threads sharing a page
+// table each have their own. not specially mapped in the kernel
+// page table.
 // the sscratch register points here.
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
@@ -78,10 +82,20 @@ struct trapframe {
   /* 264 */ uint64 t4;
   /* 272 */ uint64 t5;
   /* 280 */ uint64 t6;
+  /* 288 */ uint64 tlbflush;      // no ASID: flush the TLB on each switch
 };
 
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A process's open files and current directory, shared by
+// all its threads.
+struct fdtable {
+  struct spinlock lock;        // protects ref, ofile[] and cwd
+  int ref;                     // threads using it
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -93,14 +107,26 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int swapbusy;                // swapout() is taking a page; don't run
+  int pinned;                  // don't swap out pages (see swappin())
+  int thread;                  // made by clone(); join() reaps it, not wait()
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  uint64 trapva;               // User virtual address of trapframe
+  struct mm *mm;               // User memory, shared with threads
+  pagetable_t pagetable;       // User page table, shared with threads
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct fdtable *fdt;         // Open files and cwd, shared with threads
+  struct spawnreq *spawn;      // what spawnret() is to do
+  void (*kfn)(void);           // a kernel thread's function (see kthread())
+  uint64 ring;                 // ring_setup()'s ring, or 0
+  int logres;                  // log blocks begin_op() reserved
   char name[16];               // Process name (debugging)
+
+  // CPU time accounting, in r_time() cycles.
+  uint64 utime;                // Time spent in user mode
+  uint64 stime;                // Time spent in the kernel
+  uint64 tstamp;               // r_time() at last user/kernel transition
 };
@@ -0,0 +1,17 @@
+// Process and hart statistics returned by getprocinfo().
+// Times are in CLINT_MTIME cycles (MTIME_FREQ per second).
+
+struct procinfo {
+  int pid;
+  int ppid;
+  int state;        // enum procstate
+  uint64 sz;        // Size of process memory (bytes)
+  uint64 utime;     // Time spent in user mode
+  uint64 stime;     // Time spent in the kernel
+  char name[16];
+};
+
+struct hartinfo {
+  uint64 busy;      // Time spent running processes
+  uint64 idle;      // Time spent waiting in wfi
+};
@@ -0,0 +1,108 @@
+// Batched system calls.
+//
+// Every system call costs a trap into the kernel and back,
+// with a page table switch both ways. A program that makes
+// many small calls in a row (ls does an open(), fstat() and
+// close() per directory entry) can instead queue them in a
+// ring in its own memory and have ring_enter() run the whole
+// batch in one trap. See ring.h for the layout.
+//
+// Each queued call runs through the ordinary syscall table,
+// with its arguments swapped into the trapframe (see
+// syscallv()), so it behaves just as if it had been made
+// directly. Calls that don't return to their caller, or that
+// copy the trapframe, can't be queued.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fcntl.h"
+#include "syscall.h"
+#include "ring.h"
+
+// Map a ring of n entries into the current process.
+// Returns its address, or -1.
+uint64
+ring_setup(int n)
+{
+  struct proc *p = myproc();
+  struct ring r;
+  uint64 addr;
+
+  if(p->ring || n < 1 || n > RINGMAX || (n & (n - 1)) != 0)
+    return -1;
+  addr = mmap(0, RING_SIZE(n), PROT_READ|PROT_WRITE, MAP_PRIVATE, 0, 0);
+  if(addr == -1)
+    return -1;
+  memset(&r, 0, sizeof(r));
+  r.n = n;
+  if(copyout(p->pagetable, addr, (char*)&r, sizeof(r)) < 0){
+    munmap(addr, RING_SIZE(n));
+    return -1;
+  }
+  p->ring = addr;
+  return addr;
+}
+
+// May system call num be queued?
+static int
+ringable(int num)
+{
+  switch(num){
+  case SYS_fork:
+  case SYS_exit:
+  case SYS_exec:
+  case SYS_clone:
+  case SYS_ring_enter:
+    return 0;
+  }
+  return 1;
+}
+
+// Run the queued system calls of the current process's ring,
+// stopping early if the completion queue fills up or the
+// process is killed. Returns the number run, or -1.
+int
+ring_enter(void)
+{
+  struct proc *p = myproc();
+  struct ring r;
+  struct sqe s;
+  struct cqe c;
+  uint64 sq, cq;
+  int n = 0;
+
+  if(p->ring == 0 || copyin(p->pagetable, (char*)&r, p->ring, sizeof(r)) < 0)
+    return -1;
+  if(r.n < 1 || r.n > RINGMAX || (r.n & (r.n - 1)) != 0 ||
+     r.sqtail - r.sqhead > r.n || r.cqtail - r.cqhead > r.n)
+    return -1;
+  sq = p->ring + sizeof(struct ring);
+  cq = sq + r.n * sizeof(struct sqe);
+
+  while(r.sqhead != r.sqtail && r.cqtail - r.cqhead < r.n && !p->killed){
+    if(copyin(p->pagetable, (char*)&s, sq + (r.sqhead & (r.n-1)) * sizeof(s), sizeof(s)) < 0)
+      break;
+    c.data = s.data;
+    c.pad = 0;
+    c.res = ringable(s.num) ? syscallv(s.num, s.arg) : -1;
+    if(copyout(p->pagetable, cq + (r.cqtail & (r.n-1)) * sizeof(c), (char*)&c, sizeof(c)) < 0)
+      break;
+    r.sqhead++;
+    r.cqtail++;
+    n++;
+  }
+
+  // only write back the kernel's indices: other threads may
+  // have moved sqtail or cqhead meanwhile.
+  if(copyout(p->pagetable, p->ring + ((char*)&r.sqhead - (char*)&r),
+             (char*)&r.sqhead, sizeof(r.sqhead)) < 0 ||
+     copyout(p->pagetable, p->ring + ((char*)&r.cqtail - (char*)&r),
+             (char*)&r.cqtail, sizeof(r.cqtail)) < 0)
+    return -1;
+  return n;
+}
@@ -0,0 +1,36 @@
+// A ring of system calls for ring_enter() to run in one trap.
+// ring_setup(n) maps one into the process: a struct ring,
+// then n struct sqe (submissions), then n struct cqe
+// (completions). The caller fills in sqes and advances
+// sqtail; ring_enter() runs them in order, advancing sqhead,
+// and posts each result as a cqe at cqtail. The caller reaps
+// cqes and advances cqhead. Indices run freely and are taken
+// modulo n, which is a power of two.
+
+#define RINGMAX 256  // max entries in a ring
+
+struct sqe {
+  int num;           // system call number, from syscall.h
+  int pad;
+  uint64 arg[6];     // its arguments
+  uint64 data;       // for the caller; copied to the cqe
+};
+
+struct cqe {
+  uint64 data;
+  int res;           // what the system call returned
+  int pad;
+};
+
+struct ring {
+  uint n;
+  uint sqhead;       // next sqe for ring_enter() to run
+  uint sqtail;       // next sqe for the caller to fill in
+  uint cqhead;       // next cqe for the caller to reap
+  uint cqtail;       // next cqe for ring_enter() to post
+  uint pad;
+};
+
+#define RING_SQ(r) ((struct sqe*)((r) + 1))
+#define RING_CQ(r) ((struct cqe*)(RING_SQ(r) + (r)->n))
+#define RING_SIZE(n) (sizeof(struct ring) + (n)*(sizeof(struct sqe) + sizeof(struct cqe)))
@@ -0,0 +1,246 @@
+// Slab allocator for small kernel objects.
+//
+// A cache hands out objects of a single size, carved out of
+// pages from kalloc(). Each page (a slab) begins with a
+// struct slab, followed by as many objects as fit; a slab's
+// free objects are chained through their first word.
+//
+// In front of the slabs, each CPU keeps a magazine: a small
+// stack of free objects. Most allocations and frees only
+// touch the current CPU's magazine, with interrupts off,
+// and take no lock.
+//
+// kmalloc() serves objects without a cache of their own
+// from caches for power-of-two sizes up to 2048 bytes.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCACHE 16   // max number of caches
+#define MAGSIZE 16  // objects per CPU magazine
+#define KMALLOC_MIN 16
+#define KMALLOC_MAX 2048
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;  // partial list
+  struct slab *prev;
+  void *free;         // chain of free objects
+  int inuse;          // objects handed out
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;
+  struct spinlock lock;
+  struct slab *partial; // slabs with free objects
+  int nslab;
+  int nobj;             // objects out of the slabs, incl. magazines
+  struct {
+    int n;
+    void *obj[MAGSIZE];
+  } mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NCACHE];
+  int n;
+} slabs;
+
+static struct kmem_cache *kmalloc_cache[8]; // 16 .. 2048 bytes
+
+void
+slabinit(void)
+{
+  uint size;
+  int i;
+  static char *names[] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+  };
+
+  initlock(&slabs.lock, "slabs");
+  for(i = 0, size = KMALLOC_MIN; size <= KMALLOC_MAX; i++, size *= 2)
+    kmalloc_cache[i] = kmem_cache_create(names[i], size);
+}
+
+// Create a cache of objects of the given size.
+// The name is kept, not copied.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(void*) || size > PGSIZE - sizeof(struct slab))
+    panic("kmem_cache_create: size");
+
+  acquire(&slabs.lock);
+  if(slabs.n >= NCACHE)
+    panic("kmem_cache_create: too many");
+  c = &slabs.cache[slabs.n++];
+  release(&slabs.lock);
+
+  c->name = name;
+  c->size = size;
+  initlock(&c->lock, "kmem_cache");
+  return c;
+}
+
+static void
+slabunlink(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+static void
+slablink(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+// Take an object from the slabs, allocating a new slab if
+// none has a free object. Caller must hold c->lock.
+static void*
+slaballoc(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *p;
+  void *obj;
+
+  if((s = c->partial) == 0){
+    if((s = (struct slab*)kalloc()) == 0)
+      return 0;
+    s->cache = c;
+    s->free = 0;
+    s->inuse = 0;
+    p = (char*)s + sizeof(struct slab);
+    for(; p + c->size <= (char*)s + PGSIZE; p += c->size){
+      *(void**)p = s->free;
+      s->free = p;
+    }
+    slablink(c, s);
+    c->nslab++;
+  }
+
+  obj = s->free;
+  s->free = *(void**)obj;
+  s->inuse++;
+  c->nobj++;
+  if(s->free == 0)
+    slabunlink(c, s);
+  return obj;
+}
+
+// Return an object to its slab. An empty slab goes back
+// to kalloc() unless it is the only one with free objects.
+// Caller must hold c->lock.
+static void
+slabfree(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+
+  if(s->cache != c)
+    panic("slabfree");
+  if(s->free == 0)
+    slablink(c, s);
+  *(void**)obj = s->free;
+  s->free = obj;
+  s->inuse--;
+  c->nobj--;
+  if(s->inuse == 0 && (s->next || s->prev)){
+    slabunlink(c, s);
+    c->nslab--;
+    kfree((void*)s);
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if out of memory. The contents are undefined.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *obj = 0;
+
+  push_off();
+  int id = cpuid();
+  if(c->mag[id].n == 0){
+    // refill half the magazine.
+    acquire(&c->lock);
+    while(c->mag[id].n < MAGSIZE/2 && (obj = slaballoc(c)) != 0)
+      c->mag[id].obj[c->mag[id].n++] = obj;
+    release(&c->lock);
+  }
+  obj = 0;
+  if(c->mag[id].n > 0)
+    obj = c->mag[id].obj[--c->mag[id].n];
+  pop_off();
+  return obj;
+}
+
+// Free an object returned by kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  push_off();
+  int id = cpuid();
+  if(c->mag[id].n == MAGSIZE){
+    // flush half the magazine.
+    acquire(&c->lock);
+    while(c->mag[id].n > MAGSIZE/2)
+      slabfree(c, c->mag[id].obj[--c->mag[id].n]);
+    release(&c->lock);
+  }
+  c->mag[id].obj[c->mag[id].n++] = obj;
+  pop_off();
+}
+
+// Allocate n bytes, at most 2048.
+// Returns 0 if out of memory. The contents are undefined.
+void*
+kmalloc(uint n)
+{
+  int i;
+  uint size;
+
+  for(i = 0, size = KMALLOC_MIN; size < n; i++, size *= 2)
+    ;
+  if(size > KMALLOC_MAX)
+    panic("kmalloc: too big");
+  return kmem_cache_alloc(kmalloc_cache[i]);
+}
+
+// Free memory returned by kmalloc() or kmem_cache_alloc().
+void
+kmfree(void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+
+  kmem_cache_free(s->cache, obj);
+}
+
+// Print cache statistics. For ^P; doesn't take any locks.
+void
+slabdump(void)
+{
+  struct kmem_cache *c;
+
+  printf("cache  size  slabs  objs\n");
+  for(c = slabs.cache; c < &slabs.cache[slabs.n]; c++)
+    printf("%s  %d  %d  %d\n", c->name, c->size, c->nslab, c->nobj);
+}
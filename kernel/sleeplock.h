@@ -1,10 +1,16 @@
 // Long-term locks for processes
+//
+// A sleeplock is held either exclusively by one process
+// (acquiresleep) or shared by any number of readers
+// (acquiresleep_shared).
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // Number of shared holders
+  int wwait;         // Number of processes waiting for exclusive access
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
   char *name;        // Name of lock.
-  int pid;           // Process holding lock
+  int pid;           // Process holding lock exclusively
 };
 
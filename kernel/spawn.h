@@ -0,0 +1,10 @@
+// File actions for spawn(), applied in order to the new
+// process's descriptors before it runs the program.
+#define SPAWN_CLOSE  1  // close(fd)
+#define SPAWN_DUP2   2  // close(newfd), then make newfd refer to fd's file
+
+struct spawnact {
+  int op;
+  int fd;
+  int newfd;
+};
@@ -12,7 +12,12 @@ void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
+#ifdef TASLOCK
   lk->locked = 0;
+#else
+  lk->next = 0;
+  lk->owner = 0;
+#endif
   lk->cpu = 0;
 }
 
@@ -25,12 +30,22 @@ acquire(struct spinlock *lk)
   if(holding(lk))
     panic("acquire");
 
+#ifdef TASLOCK
   // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
     ;
+#else
+  // Take a ticket. On RISC-V, this is a single
+  //   amoadd.w a5, a5, (s1)
+  // Waiters then only read lk->owner, so the cache line
+  // stays shared until release() hands the lock on.
+  uint ticket = __sync_fetch_and_add(&lk->next, 1);
+  while(__atomic_load_n(&lk->owner, __ATOMIC_RELAXED) != ticket)
+    ;
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -59,6 +74,7 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+#ifdef TASLOCK
   // Release the lock, equivalent to lk->locked = 0.
   // This code doesn't use a C assignment, since the C standard
   // implies that an assignment might be implemented with
@@ -67,6 +83,12 @@ release(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
+#else
+  // Pass the lock to the next ticket holder. Only the holder
+  // writes lk->owner, so a plain single-copy atomic store
+  // is enough.
+  __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELAXED);
+#endif
 
   pop_off();
 }
@@ -77,7 +99,11 @@ int
 holding(struct spinlock *lk)
 {
   int r;
+#ifdef TASLOCK
   r = (lk->locked && lk->cpu == mycpu());
+#else
+  r = (lk->owner != lk->next && lk->cpu == mycpu());
+#endif
   return r;
 }
 
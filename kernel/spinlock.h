@@ -1,6 +1,16 @@
 // Mutual exclusion lock.
+//
+// A ticket lock: acquire() takes the next ticket and spins
+// until the owner counter reaches it, so waiters are served
+// in FIFO order. Build with TASLOCK=1 for the old unfair
+// test-and-set lock, for comparison.
 struct spinlock {
+#ifdef TASLOCK
   uint locked;       // Is the lock held?
+#else
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket now allowed to hold the lock.
+#endif
 
   // For debugging:
   char *name;        // Name of lock.
@@ -41,6 +41,11 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // allow supervisor mode to read the time CSR, for r_time(),
+  // and user mode too, for clock_gettime().
+  w_mcounteren(r_mcounteren() | 2);
+  w_scounteren(r_scounteren() | 2);
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -60,16 +65,22 @@ timerinit()
   int id = r_mhartid();
 
   // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
+  int interval = TICK_INTERVAL; // cycles; about 1/10th second in qemu.
   *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..3] : space for timervec to save registers.
   // scratch[4] : address of CLINT MTIMECMP register.
   // scratch[5] : desired interval (in cycles) between timer interrupts.
+  // scratch[6] : address of CLINT MTIME register.
+  // scratch[7] : when the next tick is due.
+  // scratch[8] : deadline from timerarm(), or -1 for none.
   uint64 *scratch = &mscratch0[32 * id];
   scratch[4] = CLINT_MTIMECMP(id);
   scratch[5] = interval;
+  scratch[6] = CLINT_MTIME;
+  scratch[7] = *(uint64*)CLINT_MTIMECMP(id);
+  scratch[8] = -1;
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -0,0 +1,331 @@
+// Swapping.
+//
+// When kalloc() runs dry, ualloc() makes room: first by
+// dropping unused pages from the page cache, then by writing
+// user pages out to the swap area, a region of the disk
+// after the file system (see mkfs). A swapped-out page's PTE
+// is left invalid, with PTE_SWAP set and the swap slot where
+// the physical page number would be; the next access faults
+// and swapin() reads the page back.
+//
+// Victims are chosen with the clock algorithm: a hand sweeps
+// over each process's memory in turn, clearing PTE_A, and
+// takes the first page whose PTE_A is already clear, i.e.
+// that has not been used since the hand last passed. Only
+// plain 4096-byte pages in [0, sz) that aren't shared are
+// swapped; megapages, mmap() regions and pages shared with
+// the page cache or other processes stay put.
+//
+// A page of another process is only taken while that process
+// isn't running, and p->swapbusy keeps the scheduler from
+// running it until its PTE has been updated. The current
+// process's pages can be taken too, since it is in the
+// kernel; tlbinval() has each hart drop the stale TLB entry
+// before it next goes back to the process. A process with
+// more than one thread could be running on another CPU at
+// any time, so its pages stay put. A process that is
+// copying to or from user memory with a spinlock held, where
+// swapin() can't sleep, pins its pages with swappin().
+//
+// fork() copies a swapped-out PTE, sharing the slot, so each
+// slot has a reference count.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "mm.h"
+
+#define BPP (PGSIZE / BSIZE) // blocks per page
+#define NRECLAIM 16          // pages ualloc() frees when memory runs out
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct sleeplock lock;  // one swapout() at a time; protects buf
+  struct spinlock reflock;
+  uint dev;
+  uint start;             // first block of the swap area
+  uint nslot;             // pages that fit in the swap area
+  uchar *ref;             // references to each slot; 0 if free
+  uint nused;
+  uint next;              // where to look for a free slot
+  int hand;               // the clock hand: next process to look at
+  struct buf buf;         // for disk I/O
+
+  // statistics.
+  uint64 nout;
+  uint64 nin;
+} swap;
+
+void
+swapinit(uint dev, uint start, uint nblocks)
+{
+  initsleeplock(&swap.lock, "swap");
+  initlock(&swap.reflock, "swapref");
+  swap.dev = dev;
+  swap.start = start;
+  swap.nslot = nblocks / BPP;
+  if(swap.nslot > PGSIZE)
+    swap.nslot = PGSIZE;
+  if(swap.nslot > 0){
+    if((swap.ref = kalloc()) == 0)
+      panic("swapinit");
+    memset(swap.ref, 0, PGSIZE);
+  }
+}
+
+static int
+slotalloc(void)
+{
+  uint i, s;
+
+  acquire(&swap.reflock);
+  for(i = 0; i < swap.nslot; i++){
+    s = (swap.next + i) % swap.nslot;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.nused++;
+      swap.next = s + 1;
+      release(&swap.reflock);
+      return s;
+    }
+  }
+  release(&swap.reflock);
+  return -1;
+}
+
+// Take another reference to slot, for a copy of its PTE.
+void
+swapdup(uint slot)
+{
+  acquire(&swap.reflock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.reflock);
+}
+
+// Drop a reference to slot, freeing it with the last one.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.reflock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.reflock);
+}
+
+// Read or write the page at pa from or to slot.
+// Caller must hold swap.lock.
+static void
+swapio(uint slot, char *pa, int write)
+{
+  struct buf *b = &swap.buf;
+
+  for(int i = 0; i < BPP; i++){
+    b->dev = swap.dev;
+    b->blockno = swap.start + slot*BPP + i;
+    if(write)
+      memmove(b->data, pa + i*BSIZE, BSIZE);
+    virtio_disk_rw(b, write);
+    if(!write)
+      memmove(pa + i*BSIZE, b->data, BSIZE);
+  }
+}
+
+// Is the page behind pte one that may be swapped out?
+static int
+swappable(pte_t pte)
+{
+  if((pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) || (pte & PTE_S))
+    return 0;
+  return krefcnt((void*)PTE2PA(pte)) == 1;
+}
+
+// Run the clock until it stops on a page to evict. Returns
+// its PTE, with its process in *pp and, if that isn't the
+// current process, p->swapbusy set. Caller must hold
+// swap.lock.
+static pte_t*
+victim(struct proc **pp)
+{
+  struct proc *p;
+  struct mm *mm;
+  pte_t *pte;
+  int n;
+
+  // each process gets two sweeps, the first of which may
+  // only clear PTE_A bits.
+  for(n = 0; n < 2*NPROC; n++){
+    p = &proc[swap.hand];
+    acquire(&p->lock);
+    if(!p->pinned && p->mm && p->mm->ref == 1 && (p == myproc() ||
+       ((p->state == SLEEPING || p->state == RUNNABLE) && !p->swapbusy))){
+      mm = p->mm;
+      for(; mm->swaphand < mm->sz; mm->swaphand += PGSIZE){
+        pte = walk(p->pagetable, mm->swaphand, 0);
+        if(pte == 0 || !swappable(*pte))
+          continue;
+        if(*pte & PTE_A){
+          // flush it, so the next use sets PTE_A again.
+          *pte &= ~PTE_A;
+          tlbinval(p->pagetable);
+          continue;
+        }
+        mm->swaphand += PGSIZE;
+        if(p != myproc())
+          p->swapbusy = 1;
+        release(&p->lock);
+        *pp = p;
+        return pte;
+      }
+      mm->swaphand = 0;
+    }
+    release(&p->lock);
+    swap.hand = (swap.hand + 1) % NPROC;
+  }
+  return 0;
+}
+
+// Write one user page out to swap and free it.
+// Returns 0 on success, -1 if there is nothing to evict
+// or no room in the swap area.
+static int
+swapout(void)
+{
+  struct proc *p;
+  pte_t *pte;
+  char *pa;
+  int slot;
+
+  acquiresleep(&swap.lock);
+  if((slot = slotalloc()) < 0){
+    releasesleep(&swap.lock);
+    return -1;
+  }
+  if((pte = victim(&p)) == 0){
+    releasesleep(&swap.lock);
+    swapfree(slot);
+    return -1;
+  }
+  pa = (char*)PTE2PA(*pte);
+  swapio(slot, pa, 1);
+
+  acquire(&p->lock);
+  *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D)) | PTE_SWAP;
+  tlbinval(p->pagetable);
+  p->swapbusy = 0;
+  release(&p->lock);
+  swap.nout++;
+  releasesleep(&swap.lock);
+
+  kfree(pa);
+  return 0;
+}
+
+// If va's page in pagetable was swapped out, read it back
+// in. Caller must hold p->mm->lock.
+// Returns 0 if the page is now present, -1 if it wasn't
+// swapped out or can't be read in.
+int
+swapin(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  char *mem;
+  uint slot, flags;
+
+  if(p == 0 || pagetable != p->pagetable || va >= MAXVA)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) == 0 || (*pte & PTE_SWAP) == 0)
+    return -1;
+  // reading the disk sleeps, which can't be done while
+  // holding a spinlock, as copyout() callers sometimes do.
+  if(!intr_get())
+    return -1;
+  if((mem = ualloc(0)) == 0)
+    return -1;
+
+  slot = PTE2SLOT(*pte);
+  flags = PTE_FLAGS(*pte) & ~PTE_SWAP;
+  acquiresleep(&swap.lock);
+  swapio(slot, mem, 0);
+  swap.nin++;
+  releasesleep(&swap.lock);
+  *pte = PA2PTE(mem) | flags | PTE_A | PTE_V;
+  swapfree(slot);
+  return 0;
+}
+
+// Fault in the pages of [va, va+n) of the current process, as
+// uvmtouch() does, and keep its pages from being swapped out
+// until swapunpin(). For copies to or from user memory that are
+// done with a spinlock held, possibly after sleeping.
+void
+swappin(uint64 va, uint64 n, int perm)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  p->pinned++;
+  release(&p->lock);
+  uvmtouch(va, n, perm);
+}
+
+void
+swapunpin(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  p->pinned--;
+  release(&p->lock);
+}
+
+// Free up to n pages of memory, from the page cache if it
+// has pages to spare, otherwise by swapping. Returns the
+// number freed. May sleep.
+int
+reclaim(int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(!pcshrink() && swapout() < 0)
+      break;
+  return i;
+}
+
+// Allocate a page of user memory, like kalloc(), or like
+// kalloc_zeroed() if zero is set, reclaiming memory if none
+// is free. Returns 0 if none can be found. May sleep, so
+// the caller must not hold a spinlock.
+void*
+ualloc(int zero)
+{
+  void *mem;
+
+  for(;;){
+    if((mem = zero ? kalloc_zeroed() : kalloc()) != 0)
+      return mem;
+    if(reclaim(NRECLAIM) == 0)
+      return 0;
+  }
+}
+
+// Print swap statistics. For ^P; doesn't take any locks.
+void
+swapdump(void)
+{
+  printf("swap: %d/%d slots used, %d out, %d in\n",
+         swap.nused, swap.nslot, (int)swap.nout, (int)swap.nin);
+}
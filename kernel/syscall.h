@@ -20,3 +20,24 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_getprocinfo 22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_spawn  25
+#define SYS_clone  26
+#define SYS_join   27
+#define SYS_futex_wait 28
+#define SYS_futex_wake 29
+#define SYS_ring_setup 30
+#define SYS_ring_enter 31
+#define SYS_readv  32
+#define SYS_writev 33
+#define SYS_pread  34
+#define SYS_pwrite 35
+#define SYS_sendfile 36
+#define SYS_splice 37
+#define SYS_fcntl  38
+#define SYS_poll   39
+#define SYS_clock_gettime 40
+#define SYS_nanosleep 41
+#define SYS_fsync  42
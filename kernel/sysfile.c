@@ -15,23 +15,34 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "spawn.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
-// and return both the descriptor and the corresponding struct file.
+// and return both the descriptor and the corresponding struct file,
+// with a reference that the caller must fileclose(): another thread
+// could close the descriptor at any time.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
   struct file *f;
+  struct fdtable *fdt = myproc()->fdt;
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE)
     return -1;
+  acquire(&fdt->lock);
+  if((f = fdt->ofile[fd]) == 0){
+    release(&fdt->lock);
+    return -1;
+  }
+  filedup(f);
+  release(&fdt->lock);
   if(pfd)
     *pfd = fd;
-  if(pf)
-    *pf = f;
+  *pf = f;
   return 0;
 }
 
@@ -41,17 +52,40 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct fdtable *fdt = myproc()->fdt;
 
+  // other threads may be allocating too.
+  acquire(&fdt->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(fdt->ofile[fd] == 0){
+      fdt->ofile[fd] = f;
+      release(&fdt->lock);
       return fd;
     }
   }
+  release(&fdt->lock);
   return -1;
 }
 
+// Empty descriptor fd if it still refers to f, and drop
+// the reference it held. Another thread may have closed
+// it already.
+static int
+fdfree(int fd, struct file *f)
+{
+  struct fdtable *fdt = myproc()->fdt;
+
+  acquire(&fdt->lock);
+  if(fdt->ofile[fd] != f){
+    release(&fdt->lock);
+    return -1;
+  }
+  fdt->ofile[fd] = 0;
+  release(&fdt->lock);
+  fileclose(f);
+  return 0;
+}
+
 uint64
 sys_dup(void)
 {
@@ -60,9 +94,11 @@ sys_dup(void)
 
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  // the new descriptor takes over argfd()'s reference.
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -70,38 +106,217 @@ uint64
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = fileread(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 uint64
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r;
+  uint64 p;
+
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filewrite(f, p, n);
+  fileclose(f);
+  return r;
+}
+
+// Fetch the array of niov iovecs at user address addr.
+// The total length must fit in an int.
+static int
+argiov(uint64 addr, int niov, struct iovec *iov)
+{
+  uint64 tot = 0;
+
+  if(niov < 0 || niov > MAXIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, niov*sizeof(iov[0])) < 0)
+    return -1;
+  for(int i = 0; i < niov; i++)
+    tot += iov[i].len;
+  return tot > 0x7fffffff ? -1 : 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int niov, r;
+  uint64 p;
+
+  if(argaddr(1, &p) < 0 || argint(2, &niov) < 0)
+    return -1;
+  if(argiov(p, niov, iov) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filereadv(f, iov, niov);
+  fileclose(f);
+  return r;
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int niov, r;
+  uint64 p;
+
+  if(argaddr(1, &p) < 0 || argint(2, &niov) < 0)
+    return -1;
+  if(argiov(p, niov, iov) < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filewritev(f, iov, niov);
+  fileclose(f);
+  return r;
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off, r;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argaddr(1, &p) < 0 || argint(2, &n) < 0 || argint(3, &off) < 0)
+    return -1;
+  if(n < 0 || off < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filepread(f, p, n, off);
+  fileclose(f);
+  return r;
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off, r;
+  uint64 p;
+
+  if(argaddr(1, &p) < 0 || argint(2, &n) < 0 || argint(3, &off) < 0)
+    return -1;
+  if(n < 0 || off < 0 || argfd(0, 0, &f) < 0)
+    return -1;
+  r = filepwrite(f, p, n, off);
+  fileclose(f);
+  return r;
+}
+
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n, r;
+  uint o;
+
+  if(argint(2, &off) < 0 || argint(3, &n) < 0 || off < -1)
+    return -1;
+  if(argfd(0, 0, &out) < 0)
+    return -1;
+  if(argfd(1, 0, &in) < 0){
+    fileclose(out);
+    return -1;
+  }
+  o = off;
+  r = -1;
+  if(in->type == FD_INODE)
+    r = filesend(out, in, off == -1 ? 0 : &o, n);
+  fileclose(in);
+  fileclose(out);
+  return r;
+}
+
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n, r;
+
+  if(argint(2, &n) < 0 || argfd(0, 0, &in) < 0)
+    return -1;
+  if(argfd(1, 0, &out) < 0){
+    fileclose(in);
+    return -1;
+  }
+  r = filesend(out, in, 0, n);
+  fileclose(out);
+  fileclose(in);
+  return r;
+}
+
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg, r = -1;
+
+  if(argint(1, &cmd) < 0 || argint(2, &arg) < 0 || argfd(0, 0, &f) < 0)
     return -1;
+  switch(cmd){
+  case F_GETFL:
+    r = f->nonblock ? O_NONBLOCK : 0;
+    break;
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    r = 0;
+    break;
+  }
+  fileclose(f);
+  return r;
+}
+
+uint64
+sys_poll(void)
+{
+  uint64 fds;
+  int n, timeout;
 
-  return filewrite(f, p, n);
+  if(argaddr(0, &fds) < 0 || argint(1, &n) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  return poll(fds, n, timeout);
+}
+
+// Wait until what has been written to the file is on disk.
+// The log commits every file's changes together, so this
+// commits them all.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+  int r = -1;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type == FD_INODE){
+    log_sync();
+    r = 0;
+  }
+  fileclose(f);
+  return r;
 }
 
 uint64
 sys_close(void)
 {
-  int fd;
+  int fd, r;
   struct file *f;
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  // another thread may have closed it meanwhile.
+  r = fdfree(fd, f);
   fileclose(f);
-  return 0;
+  return r;
 }
 
 uint64
@@ -109,10 +324,13 @@ sys_fstat(void)
 {
   struct file *f;
   uint64 st; // user pointer to struct stat
+  int r;
 
-  if(argfd(0, 0, &f) < 0 || argaddr(1, &st) < 0)
+  if(argaddr(1, &st) < 0 || argfd(0, 0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, st);
+  fileclose(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -287,7 +505,7 @@ uint64
 sys_open(void)
 {
   char path[MAXPATH];
-  int fd, omode;
+  int fd, omode, writing;
   struct file *f;
   struct inode *ip;
   int n;
@@ -322,9 +540,18 @@ sys_open(void)
     return -1;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  // a file can't be written or truncated while a program
+  // is running from it (see exec.c).
+  writing = ip->type != T_DEVICE && (omode & (O_WRONLY|O_RDWR|O_TRUNC));
+  if(writing && iwriteget(ip) < 0){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
+  if((f = filealloc()) == 0){
+    if(writing)
+      iwriteput(ip);
     iunlockput(ip);
     end_op();
     return -1;
@@ -338,16 +565,24 @@ sys_open(void)
     f->off = 0;
   }
   f->ip = ip;
+  f->nonblock = (omode & O_NONBLOCK) != 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
   }
+  if(writing && !f->writable)
+    iwriteput(ip);  // only held for the truncation
 
   iunlock(ip);
   end_op();
 
+  // only now that f is set up may other threads see it.
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -391,40 +626,50 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct fdtable *fdt = myproc()->fdt;
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilock_shared(ip);
   if(ip->type != T_DIR){
-    iunlockput(ip);
+    iunlock_shared(ip);
+    iput(ip);
     end_op();
     return -1;
   }
-  iunlock(ip);
-  iput(p->cwd);
+  iunlock_shared(ip);
+  acquire(&fdt->lock);
+  old = fdt->cwd;
+  fdt->cwd = ip;
+  release(&fdt->lock);
+  iput(old);
   end_op();
-  p->cwd = ip;
   return 0;
 }
 
-uint64
-sys_exec(void)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Copy the user argv array at uargv into argv, each string
+// into a page of its own. Returns 0, or -1 after freeing
+// whatever was copied.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -440,18 +685,53 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
 
-  int ret = exec(path, argv);
+ bad:
+  freeargv(argv);
+  return -1;
+}
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
 
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = exec(path, argv);
+
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  struct spawnact act[MAXSPAWNACT];
+  uint64 uargv, uact;
+  int nact;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &uact) < 0 || argint(3, &nact) < 0)
+    return -1;
+  if(nact < 0 || nact > MAXSPAWNACT)
+    return -1;
+  if(nact > 0 && copyin(myproc()->pagetable, (char*)act, uact, nact*sizeof(act[0])) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = spawn(path, argv, act, nact);
+
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -469,18 +749,50 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
-    fileclose(rf);
+      fdfree(fd0, rf);
+    else
+      fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
-    fileclose(rf);
-    fileclose(wf);
+    fdfree(fd0, rf);
+    fdfree(fd1, wf);
     return -1;
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr;
+  int len, prot, flags, off;
+  struct file *f = 0;
+  uint64 r;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0)
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  // mmap() takes its own reference to f.
+  r = mmap(addr, len, prot, flags, f, off);
+  if(f)
+    fileclose(f);
+  return r;
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "time.h"
 
 uint64
 sys_exit(void)
@@ -39,17 +40,74 @@ sys_wait(void)
 }
 
 uint64
-sys_sbrk(void)
+sys_clone(void)
+{
+  uint64 fn, arg, sp;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &sp) < 0)
+    return -1;
+  return clone(fn, arg, sp);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &p) < 0)
+    return -1;
+  return join(tid, p);
+}
+
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futex_wait(addr, val);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futex_wake(addr, n);
+}
+
+uint64
+sys_ring_setup(void)
 {
-  int addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  return ring_setup(n);
+}
+
+uint64
+sys_ring_enter(void)
+{
+  return ring_enter();
+}
+
+uint64
+sys_sbrk(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
     return -1;
-  return addr;
+  // growproc() returns the old size, which other
+  // threads may be changing too.
+  return growproc(n);
 }
 
 uint64
@@ -73,6 +131,34 @@ sys_sleep(void)
   return 0;
 }
 
+uint64
+sys_clock_gettime(void)
+{
+  struct timespec ts;
+  uint64 addr, t = r_time();
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  ts.sec = t / MTIME_FREQ;
+  ts.nsec = (t % MTIME_FREQ) * NSEC_PER_SEC / MTIME_FREQ;
+  return copyout(myproc()->pagetable, addr, (char*)&ts, sizeof(ts));
+}
+
+uint64
+sys_nanosleep(void)
+{
+  struct timespec ts;
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)&ts, addr, sizeof(ts)) < 0)
+    return -1;
+  if(ts.nsec >= NSEC_PER_SEC || ts.sec > 1000000)
+    return -1;
+  return timerwait(r_time() + ts.sec*MTIME_FREQ + ts.nsec*MTIME_FREQ/NSEC_PER_SEC);
+}
+
 uint64
 sys_kill(void)
 {
@@ -95,3 +181,16 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// copy per-process and per-hart CPU usage to user space.
+uint64
+sys_getprocinfo(void)
+{
+  uint64 pi, hi;
+  int npi, nhi;
+
+  if(argaddr(0, &pi) < 0 || argint(1, &npi) < 0 ||
+     argaddr(2, &hi) < 0 || argint(3, &nhi) < 0)
+    return -1;
+  return procinfo(pi, npi, hi, nhi);
+}
@@ -0,0 +1,7 @@
+// A time, for clock_gettime() and nanosleep().
+struct timespec {
+  uint64 sec;
+  uint64 nsec;   // 0 .. 999999999
+};
+
+#define NSEC_PER_SEC 1000000000L
@@ -0,0 +1,119 @@
+// Timers: sleeping until a given r_time().
+//
+// A sleeper waits on a queue, sorted by deadline. Besides the
+// regular tick, each CPU's timer can be asked for an interrupt
+// at the earliest deadline (see timervec in kernelvec.S), so
+// the sleeper is woken on time rather than at the next tick.
+// Every CPU's timer interrupt looks at the queue, not just the
+// one that counts ticks.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+
+// A sleeper, on its kernel stack.
+struct timer {
+  uint64 when;           // r_time() to wake at
+  int done;              // taken off the queue
+  struct timer *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct timer *head;    // earliest first
+} timers;
+
+extern uint64 mscratch0[];  // see start.c
+uint64 lasttick[NCPU];      // each CPU's tick at the last ticked()
+
+void
+timerqinit(void)
+{
+  initlock(&timers.lock, "timers");
+}
+
+// Ask for a timer interrupt on this CPU at when, unless it
+// has asked for an earlier one. timervec forgets the deadline
+// once it has come.
+static void
+timerarm(uint64 when)
+{
+  volatile uint64 *scratch, *cmp;
+
+  push_off();
+  scratch = &mscratch0[32 * cpuid()];
+  cmp = (uint64*)CLINT_MTIMECMP(cpuid());
+  if(when < scratch[8])
+    scratch[8] = when;
+  // if timervec ran since scratch[8] was set, when has
+  // passed, and this just brings on one more interrupt.
+  if(when < *cmp)
+    *cmp = when;
+  pop_off();
+}
+
+// Sleep until r_time() reaches when.
+// Returns 0, or -1 if the process was killed.
+int
+timerwait(uint64 when)
+{
+  struct proc *p = myproc();
+  struct timer t, **tp;
+
+  t.when = when;
+  t.done = 0;
+  acquire(&timers.lock);
+  for(tp = &timers.head; *tp && (*tp)->when <= when; tp = &(*tp)->next)
+    ;
+  t.next = *tp;
+  *tp = &t;
+  if(timers.head == &t)
+    timerarm(when);
+  while(!t.done && !p->killed)
+    sleep(&t, &timers.lock);
+  if(!t.done){
+    for(tp = &timers.head; *tp != &t; tp = &(*tp)->next)
+      ;
+    *tp = t.next;
+  }
+  release(&timers.lock);
+  return p->killed ? -1 : 0;
+}
+
+// Wake the sleepers whose deadline has come, and ask for an
+// interrupt at the next one. Called by devintr() on each
+// timer interrupt.
+void
+timertick(void)
+{
+  struct timer *t;
+  uint64 now = r_time();
+
+  acquire(&timers.lock);
+  while((t = timers.head) != 0 && (long)(t->when - now) <= 0){
+    timers.head = t->next;
+    t->done = 1;
+    wakeup(t);
+  }
+  if(timers.head)
+    timerarm(timers.head->when);
+  release(&timers.lock);
+}
+
+// Whether this CPU's timer interrupt was for a tick, rather
+// than only for a deadline. Called with interrupts off.
+int
+ticked(void)
+{
+  int id = cpuid();
+  uint64 next = mscratch0[32 * id + 7];
+
+  if(next == lasttick[id])
+    return 0;
+  lasttick[id] = next;
+  return 1;
+}
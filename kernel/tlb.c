@@ -0,0 +1,223 @@
+// Address-space IDs and TLB flushes.
+//
+// Each user page table runs under an address-space ID (ASID),
+// which usertrapret() puts in satp next to the page table. The
+// TLB tags its entries with the ASID, so the switches between
+// the kernel's page table (ASID 0) and a process's on every
+// trap, and between processes on a hart, don't need to flush
+// anything: a process's entries are still there when it gets
+// back to user space.
+//
+// ASIDs are handed out in generations, as in Linux: an mm takes
+// the next unused one the first time it runs in the current
+// generation. When they run out, a new generation starts, and
+// each hart flushes its whole TLB once before it runs anything
+// under an ASID of the new generation; everyone else gets a new
+// ASID the next time they run. So an ASID never has to be freed
+// and no flush is needed when one is handed out, and there are
+// always enough, however few the hardware has.
+//
+// What does need a flush is changing a PTE that some TLB may
+// hold. tlbinval() marks the page table's ASID stale on every
+// hart, and a hart flushes that ASID (only) on its way back to
+// user space. A thread of the same process that is in user
+// space on another hart meanwhile goes on using the old entries
+// until its next trap, so uvmunmap() doesn't free a page
+// unmapped from a page table that threads share until then:
+// tlbwait() waits until each hart running one of them has come
+// into the kernel or switched away, counted in hartpass[].
+//
+// If the hardware has no ASIDs, every page table runs under
+// ASID 0 and trampoline.S flushes the whole TLB on the way in
+// and out, as before.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+#include "sleeplock.h"
+#include "mm.h"
+
+#define NASID 128  // at most; a new generation starts after this many
+#define ALLHARTS ((1 << NCPU) - 1)
+#define ASIDGEN(ctx) ((ctx) >> 16)  // mm->asid's generation
+
+extern pagetable_t kernel_pagetable;
+
+struct {
+  struct spinlock lock;
+  int nasid;                 // user page tables get 1 .. nasid-1
+  uint64 gen;                // the current generation; starts at 1
+  int next;                  // the next ASID to hand out in it
+  pagetable_t owner[NASID];  // the page table given each ASID in it
+} asids;
+
+// for each ASID, a bit for every hart that has to flush it
+// before going to user space with it. Updated atomically,
+// without asids.lock.
+static uint stale[NASID];
+
+// the generation of ASIDs each hart's TLB may hold entries of.
+static uint64 hartgen[NCPU];
+
+// how many times each hart has come into the kernel from user
+// space or switched away from a process. Only the hart itself
+// writes its count.
+static uint64 hartpass[NCPU];
+
+// Find out how many ASIDs the hardware has, by trying to set
+// all the bits of satp's ASID field. Called on hart 0 once
+// paging is on.
+void
+tlbinit(void)
+{
+  uint64 max;
+
+  initlock(&asids.lock, "asids");
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID(0xffff));
+  max = SATP2ASID(r_satp());
+  w_satp(MAKE_SATP(kernel_pagetable));
+  sfence_vma();
+  asids.nasid = max + 1 < NASID ? max + 1 : NASID;
+  asids.gen = 1;
+  asids.next = 1;
+}
+
+// Give p's mm an ASID of the current generation, starting a
+// new one if they have all been handed out. Returns the new
+// mm->asid.
+static uint64
+asidalloc(struct proc *p)
+{
+  struct mm *mm = p->mm;
+  uint64 ctx;
+  int a;
+
+  acquire(&asids.lock);
+  if(ASIDGEN(mm->asid) != asids.gen){
+    if(asids.next == asids.nasid){
+      asids.gen++;
+      asids.next = 1;
+      memset(asids.owner, 0, sizeof(asids.owner));
+    }
+    a = asids.next++;
+    asids.owner[a] = p->pagetable;
+    __sync_fetch_and_and(&stale[a], 0);
+    __atomic_store_n(&mm->asid, asids.gen << 16 | a, __ATOMIC_RELAXED);
+  }
+  ctx = mm->asid;
+  release(&asids.lock);
+  return ctx;
+}
+
+// pagetable is being freed: forget it, so that a new page
+// table at the same address isn't taken for it.
+void
+asidfree(pagetable_t pagetable)
+{
+  int a;
+
+  acquire(&asids.lock);
+  for(a = 1; a < asids.next; a++)
+    if(asids.owner[a] == pagetable)
+      asids.owner[a] = 0;
+  release(&asids.lock);
+}
+
+// A PTE of pagetable has changed: make every hart flush its
+// ASID before using it again. Doesn't need asids.lock; at
+// worst a race with a new generation costs a needless flush,
+// and a page table left with an ASID of an old generation
+// gets a new one, and a clean TLB, before it runs again.
+void
+tlbinval(pagetable_t pagetable)
+{
+  int a;
+
+  for(a = 1; a < asids.next; a++){
+    if(asids.owner[a] == pagetable){
+      __sync_fetch_and_or(&stale[a], ALLHARTS);
+      break;
+    }
+  }
+}
+
+// Get ready to go to user space in p: return the ASID to run
+// its page table under, having flushed whatever of this hart's
+// TLB may be stale for it, or 0 if there are no ASIDs and
+// trampoline.S must flush it all. Called with interrupts off.
+int
+tlbswitch(struct proc *p)
+{
+  int id = cpuid();
+  uint bit = 1 << id;
+  uint64 ctx;
+  int a;
+
+  if(asids.nasid <= 1)
+    return 0;
+  // the generation and the ASID have to be read together,
+  // as another thread may be giving the mm a new one.
+  ctx = __atomic_load_n(&p->mm->asid, __ATOMIC_RELAXED);
+  if(ASIDGEN(ctx) != asids.gen)
+    ctx = asidalloc(p);
+  a = ctx & 0xffff;
+  if(hartgen[id] != ASIDGEN(ctx)){
+    // entries of another generation's ASIDs may be left.
+    __sync_fetch_and_and(&stale[a], ~bit);
+    hartgen[id] = ASIDGEN(ctx);
+    sfence_vma();
+  } else if(stale[a] & bit){
+    __sync_fetch_and_and(&stale[a], ~bit);
+    sfence_vma_asid(a);
+  }
+  return a;
+}
+
+// This hart has come into the kernel from user space, or
+// stopped running a process: it will go through tlbswitch()
+// before it next runs user code. Called with interrupts off,
+// or from the scheduler.
+void
+tlbpass(void)
+{
+  int id = cpuid();
+
+  __atomic_store_n(&hartpass[id], hartpass[id] + 1, __ATOMIC_RELAXED);
+  // order it before reading stale[] in tlbswitch().
+  __sync_synchronize();
+}
+
+// Wait until no other hart can still be using TLB entries of
+// mm's page table that tlbinval() was called for before this:
+// until each hart that is running one of mm's threads has
+// passed through tlbpass(). May sleep, by yielding.
+void
+tlbwait(struct mm *mm)
+{
+  uint64 seen[NCPU];
+  struct proc *p;
+  int i, me;
+
+  push_off();
+  me = cpuid();
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++)
+    seen[i] = __atomic_load_n(&hartpass[i], __ATOMIC_RELAXED);
+  pop_off();
+
+  for(i = 0; i < NCPU; i++){
+    if(i == me)
+      continue;
+    // a hart that isn't running mm now will see its ASID
+    // stale before it does.
+    p = __atomic_load_n(&cpus[i].proc, __ATOMIC_RELAXED);
+    if(p == 0 || p->mm != mm)
+      continue;
+    while(__atomic_load_n(&hartpass[i], __ATOMIC_RELAXED) == seen[i])
+      yield();
+  }
+}
@@ -44,8 +44,14 @@ usertrap(void)
   // send interrupts and exceptions to kerneltrap(),
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
+  tlbpass();
 
   struct proc *p = myproc();
+
+  // charge the time since usertrapret() to user mode.
+  uint64 now = r_time();
+  p->utime += now - p->tstamp;
+  p->tstamp = now;
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -67,6 +73,22 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault; perhaps on a page that is swapped out or
+    // not yet paged in. read scause and stval before
+    // interrupts can overwrite them.
+    uint64 scause = r_scause();
+    uint64 va = r_stval();
+    int perm = scause == 12 ? PTE_X : (scause == 13 ? PTE_R : PTE_W);
+
+    // filling the page may sleep reading the disk.
+    intr_on();
+
+    if(uvmfault(p->pagetable, va, perm) < 0){
+      printf("usertrap(): page fault %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, va);
+      p->killed = 1;
+    }
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -118,14 +140,22 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // and whether it must flush the TLB.
+  int asid = tlbswitch(p);
+  uint64 satp = MAKE_SATP(p->pagetable) | SATP_ASID(asid);
+  p->trapframe->tlbflush = asid == 0;
+
+  // charge the time since entering the kernel to system time.
+  uint64 now = r_time();
+  p->stime += now - p->tstamp;
+  p->tstamp = now;
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64,uint64))fn)(p->trapva, satp, asid == 0);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -166,6 +196,7 @@ clockintr()
   ticks++;
   wakeup(&ticks);
   release(&tickslock);
+  polltick();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -204,10 +235,11 @@ devintr()
     // software interrupt from a machine-mode timer interrupt,
     // forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
+    if(ticked() && cpuid() == 0){
       clockintr();
     }
-    
+    timertick();
+
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
@@ -0,0 +1,5 @@
+// One of the buffers of a readv() or writev().
+struct iovec {
+  void *base;
+  uint len;
+};
@@ -41,6 +41,10 @@ static struct disk {
     struct buf *b;
     char status;
   } info[NUM];
+
+  // the type/sector headers of requests, also indexed by
+  // first descriptor index of chain.
+  struct virtio_blk_outhdr ops[NUM];
   
   struct spinlock vdisk_lock;
   
@@ -165,46 +169,30 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// fill in the three descriptors idx[] for a read or write of b,
+// and put them on the avail ring. the caller must hold
+// vdisk_lock, and notify the device.
+static void
+queue(struct buf *b, int write, int *idx)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
-  acquire(&disk.vdisk_lock);
-
   // the spec says that legacy block operations use three
   // descriptors: one for type/reserved/sector, one for
   // the data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-  
-  // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
+  struct virtio_blk_outhdr *buf0 = &disk.ops[idx[0]];
 
   if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk.desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk.desc[idx[0]].len = sizeof(buf0);
+    buf0->type = VIRTIO_BLK_T_IN; // read the disk
+  buf0->reserved = 0;
+  buf0->sector = sector;
+
+  disk.desc[idx[0]].addr = (uint64) buf0;
+  disk.desc[idx[0]].len = sizeof(*buf0);
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
@@ -234,6 +222,23 @@ virtio_disk_rw(struct buf *b, int write)
   disk.avail[2 + (disk.avail[1] % NUM)] = idx[0];
   __sync_synchronize();
   disk.avail[1] = disk.avail[1] + 1;
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  acquire(&disk.vdisk_lock);
+
+  // allocate the three descriptors.
+  int idx[3];
+  while(1){
+    if(alloc3_desc(idx) == 0) {
+      break;
+    }
+    sleep(&disk.free[0], &disk.vdisk_lock);
+  }
+
+  queue(b, write, idx);
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
@@ -248,6 +253,40 @@ virtio_disk_rw(struct buf *b, int write)
   release(&disk.vdisk_lock);
 }
 
+// write the n buffers in bs[] as a batch: queue as many
+// requests as there are descriptors for, notify the device
+// once, and wait for them all. the device may do them in
+// any order, so the caller can't count on one reaching the
+// disk before another.
+void
+virtio_disk_writev(struct buf **bs, int n)
+{
+  int idx[3], head[NUM/3];
+  int i, j, k;
+
+  acquire(&disk.vdisk_lock);
+  for(i = 0; i < n; i = j){
+    for(j = i; j < n && j - i < NUM/3 && alloc3_desc(idx) == 0; j++){
+      queue(bs[j], 1, idx);
+      head[j - i] = idx[0];
+    }
+    if(j == i){
+      sleep(&disk.free[0], &disk.vdisk_lock);
+      continue;
+    }
+
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+
+    for(k = i; k < j; k++){
+      while(bs[k]->disk == 1)
+        sleep(bs[k], &disk.vdisk_lock);
+      disk.info[head[k - i]].b = 0;
+      free_chain(head[k - i]);
+    }
+  }
+  release(&disk.vdisk_lock);
+}
+
 void
 virtio_disk_intr()
 {
@@ -5,6 +5,10 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "mm.h"
 
 /*
  * the kernel's page table.
@@ -15,14 +19,15 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static pte_t *walklevel(pagetable_t, uint64, int, int);
+
 /*
  * create a direct-map page table for the kernel.
  */
 void
 kvminit()
 {
-  kernel_pagetable = (pagetable_t) kalloc();
-  memset(kernel_pagetable, 0, PGSIZE);
+  kernel_pagetable = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -68,24 +73,74 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A level-1 PTE can itself be a leaf (marked with PTE_S) that
+// maps a whole 2MB megapage; if va falls in one, walk()
+// returns that level-1 PTE.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, alloc, 0);
+}
+
+// Like walk(), but stop at the PTE for va in the level-leaf
+// page-table page.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int leaf)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(int level = 2; level > leaf; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(*pte & PTE_S)
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(leaf, va)];
+}
+
+// Physical address of the 4096-byte page containing va,
+// given the leaf PTE that maps va.
+static uint64
+pteaddr(pte_t pte, uint64 va)
+{
+  uint64 pa = PTE2PA(pte);
+
+  if(pte & PTE_S)
+    pa += PGROUNDDOWN(va) % SUPERPGSIZE;
+  return pa;
+}
+
+// Replace the megapage PTE that maps va with a level-0
+// page-table page holding 512 PTEs for the same memory and
+// permissions, so that part of it can be unmapped or changed.
+// pt is the page to use for the new page-table page; if it
+// lies within the megapage itself, its own PTE is left empty.
+static void
+demote(pagetable_t pagetable, uint64 va, pagetable_t pt)
+{
+  pte_t *pte;
+  uint64 pa;
+  int flags;
+
+  if((pte = walklevel(pagetable, va, 0, 1)) == 0 || (*pte & PTE_S) == 0)
+    panic("demote");
+  pa = PTE2PA(*pte);
+  flags = PTE_FLAGS(*pte) & ~PTE_S;
+  for(int i = 0; i < 512; i++){
+    if(pa + i*PGSIZE == (uint64)pt)
+      pt[i] = 0;
+    else
+      pt[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  }
+  *pte = PA2PTE(pt) | PTE_V;
 }
 
 // Look up a virtual address, return the physical address,
@@ -107,7 +162,7 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = pteaddr(*pte, va);
   return pa;
 }
 
@@ -137,7 +192,7 @@ kvmpa(uint64 va)
     panic("kvmpa");
   if((*pte & PTE_V) == 0)
     panic("kvmpa");
-  pa = PTE2PA(*pte);
+  pa = pteaddr(*pte, va);
   return pa+off;
 }
 
@@ -145,6 +200,9 @@ kvmpa(uint64 va)
 // physical addresses starting at pa. va and size might not
 // be page-aligned. Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
+// Wherever va and pa are both 2MB-aligned and at least 2MB
+// remain, uses a single megapage PTE, which saves a
+// page-table page and covers 512 times as much per TLB entry.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
@@ -154,6 +212,23 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       last - a >= SUPERPGSIZE - PGSIZE){
+      if((pte = walklevel(pagetable, a, 1, 1)) == 0)
+        return -1;
+      if(*pte & PTE_S)
+        panic("remap");
+      // if a page-table page is already there, fall
+      // through and use ordinary pages.
+      if((*pte & PTE_V) == 0){
+        *pte = PA2PTE(pa) | perm | PTE_S | PTE_V;
+        if(last - a == SUPERPGSIZE - PGSIZE)
+          break;
+        a += SUPERPGSIZE;
+        pa += SUPERPGSIZE;
+        continue;
+      }
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -167,31 +242,149 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Pages unmapped from a page table that other threads may be
+// using on other harts, whose TLBs may still hold them. They
+// are freed in batches, once those TLBs can't (tlbwait()).
+#define NGATHER 32
+
+struct gather {
+  struct mm *mm;           // 0 if the pages can be freed at once
+  pagetable_t pagetable;
+  int n;
+  uint64 pa[NGATHER];      // with the block's order in the low bits
+};
+
+static void
+gatherflush(struct gather *g)
+{
+  if(g->n == 0)
+    return;
+  tlbinval(g->pagetable);
+  tlbwait(g->mm);
+  for(int i = 0; i < g->n; i++)
+    kfree_order((void*)PGROUNDDOWN(g->pa[i]), g->pa[i] % PGSIZE);
+  g->n = 0;
+}
+
+// Free the block of 2^order pages at pa, whose PTE has been
+// cleared, when it is safe to.
+static void
+gatherfree(struct gather *g, uint64 pa, int order)
+{
+  if(g->mm == 0){
+    kfree_order((void*)pa, order);
+    return;
+  }
+  if(g->n == NGATHER)
+    gatherflush(g);
+  g->pa[g->n++] = pa | order;
+}
+
+// Whether a is in a megapage that [va, end) covers only
+// part of.
+static int
+splits(pagetable_t pagetable, uint64 a, uint64 va, uint64 end)
+{
+  pte_t *pte;
+  uint64 s = SUPERPGROUNDDOWN(a);
+
+  if((pte = walk(pagetable, a, 0)) == 0 || (*pte & (PTE_V|PTE_S)) != (PTE_V|PTE_S))
+    return 0;
+  return s < va || s + SUPERPGSIZE > end;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
-void
+// page-aligned. Pages that were never paged in are skipped.
+// Optionally free the physical memory (or swap slots).
+// Returns 0, or -1 if there is no memory to split a megapage
+// that is only partly unmapped; then nothing has changed.
+int
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  struct proc *p = myproc();
+  struct gather g;
+  pagetable_t spare[2];
+  uint64 a, end, pa;
   pte_t *pte;
+  pagetable_t pt;
+  int nspare;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
+  if(npages == 0)
+    return 0;
+  end = va + npages*PGSIZE;
+
+  // other threads of the current process may have the pages
+  // in their TLBs.
+  g.mm = 0;
+  if(do_free && p && p->pagetable == pagetable && p->mm->ref > 1)
+    g.mm = p->mm;
+  g.pagetable = pagetable;
+  g.n = 0;
+
+  // splitting a megapage that is only partly unmapped needs a
+  // page-table page. One of its pages that is being freed is
+  // recycled, so this can't run out of memory, unless another
+  // thread may still be writing that page: then get the (at
+  // most two) pages first, before anything changes.
+  nspare = 0;
+  if(!do_free || g.mm){
+    for(a = va; ; a = end - PGSIZE){
+      if(splits(pagetable, a, va, end)){
+        if((pt = g.mm ? ualloc(0) : kalloc()) == 0){
+          while(nspare > 0)
+            kfree(spare[--nspare]);
+          return -1;
+        }
+        spare[nspare++] = pt;
+      }
+      if(SUPERPGROUNDDOWN(a) == SUPERPGROUNDDOWN(end - PGSIZE))
+        break;
+    }
+  }
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+  for(a = va; a < end; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0 || *pte == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      if(do_free)
+        swapfree(PTE2SLOT(*pte));
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
       panic("uvmunmap: not mapped");
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+    if(*pte & PTE_S){
+      if(a % SUPERPGSIZE == 0 && a + SUPERPGSIZE <= end){
+        pa = PTE2PA(*pte);
+        *pte = 0;
+        if(do_free)
+          gatherfree(&g, pa, SUPERPGORDER);
+        a += SUPERPGSIZE - PGSIZE;
+        continue;
+      }
+      // only part of the megapage goes: split it.
+      if(nspare > 0){
+        demote(pagetable, a, spare[--nspare]);
+        pte = walk(pagetable, a, 0);
+      } else if(do_free && g.mm == 0){
+        demote(pagetable, a, (pagetable_t)pteaddr(*pte, a));
+        continue;
+      } else {
+        panic("uvmunmap: demote");
+      }
     }
+    pa = PTE2PA(*pte);
     *pte = 0;
+    if(do_free)
+      gatherfree(&g, pa, 0);
   }
+  tlbinval(pagetable);
+  gatherflush(&g);
+  return 0;
 }
 
 // create an empty user page table.
@@ -200,10 +393,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -217,14 +409,14 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// May swap out other pages to make room.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
@@ -236,12 +428,23 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    if(a % SUPERPGSIZE == 0 && a + SUPERPGSIZE <= newsz &&
+       (mem = kalloc_order(SUPERPGORDER)) != 0){
+      // this 2MB of the new region can be a megapage.
+      memset(mem, 0, SUPERPGSIZE);
+      if(mappages(pagetable, a, SUPERPGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+        kfree_order(mem, SUPERPGORDER);
+        uvmdealloc(pagetable, a, oldsz);
+        return 0;
+      }
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    mem = ualloc(1);
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -254,7 +457,8 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz if
+// the memory can't be unmapped (see uvmunmap()).
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
@@ -263,7 +467,8 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-    uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+    if(uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1) < 0)
+      return oldsz;
   }
 
   return newsz;
@@ -302,27 +507,51 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 // Given a parent process's page table, copy
 // its memory into a child's page table.
 // Copies both the page table and the
-// physical memory.
+// physical memory, except for read-only pages
+// (program text), which are shared.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
   char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+    if((pte = walk(old, i, 0)) == 0 || *pte == 0)
+      continue;  // not paged in yet
+    if(*pte & PTE_SWAP){
+      // the child shares the swap slot.
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      swapdup(PTE2SLOT(*pte));
+      *npte = *pte;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
       panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if((*pte & PTE_S) && i % SUPERPGSIZE == 0 && i + SUPERPGSIZE <= sz &&
+       (mem = kalloc_order(SUPERPGORDER)) != 0){
+      memmove(mem, (char*)PTE2PA(*pte), SUPERPGSIZE);
+      if(mappages(new, i, SUPERPGSIZE, (uint64)mem, PTE_FLAGS(*pte) & ~PTE_S) != 0){
+        kfree_order(mem, SUPERPGORDER);
+        goto err;
+      }
+      i += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    pa = pteaddr(*pte, i);
+    flags = PTE_FLAGS(*pte) & ~PTE_S;
+    if((*pte & (PTE_W|PTE_U|PTE_S)) == PTE_U){
+      mem = (char*)pa;
+      kdup(mem);
+    } else if((mem = kalloc()) != 0){
+      memmove(mem, (char*)pa, PGSIZE);
+    } else {
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
+    }
     if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
       kfree(mem);
       goto err;
@@ -345,9 +574,123 @@ uvmclear(pagetable_t pagetable, uint64 va)
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
+  if(*pte & PTE_S){
+    pagetable_t pt = (pagetable_t)kalloc();
+    if(pt == 0)
+      panic("uvmclear: demote");
+    demote(pagetable, va, pt);
+    pte = walk(pagetable, va, 0);
+  }
   *pte &= ~PTE_U;
 }
 
+// Handle a fault at user address va in pagetable, which
+// needs one of PTE_R, PTE_W or PTE_X: read the page back
+// from swap, page in the program, or fill in a page of an
+// mmap()ed region. Threads sharing the page table take turns,
+// so a fault may find that another thread has already done
+// the work.
+// Returns 0 if the access may be retried, -1 if it is an error.
+int
+uvmfault(pagetable_t pagetable, uint64 va, int perm)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  int r = -1;
+
+  // all of these may sleep, which can't be done while
+  // holding a spinlock, as copyout() callers sometimes do.
+  if(p == 0 || pagetable != p->pagetable || va >= MAXVA || !intr_get())
+    return -1;
+
+  acquiresleep(&p->mm->lock);
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & (PTE_V|PTE_U|perm)) == (PTE_V|PTE_U|perm))
+    r = 0;
+  else if(swapin(pagetable, va) == 0 || execfault(pagetable, va, perm) == 0 ||
+          mmapfault(pagetable, va, perm) == 0)
+    r = 0;
+  // the TLB may still hold the old PTE, even an invalid
+  // one, and would fault again.
+  if(r == 0)
+    tlbinval(pagetable);
+  releasesleep(&p->mm->lock);
+  return r;
+}
+
+// Look up user virtual address va for the kernel to read
+// (perm PTE_R) or write (PTE_W), and return the physical
+// address of its page, or 0. Faults the page in if need be.
+static uint64
+useraddr(pagetable_t pagetable, uint64 va, int perm)
+{
+  pte_t *pte;
+  int need = PTE_V | PTE_U | (perm == PTE_W ? PTE_W : 0);
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & need) != need){
+    if(uvmfault(pagetable, va, perm) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+    if(pte == 0 || (*pte & need) != need)
+      return 0;
+  }
+  return pteaddr(*pte, va);
+}
+
+// Fault in the pages of [va, va+n) of the current process
+// ahead of a copy to (perm PTE_W) or from (PTE_R) them that
+// will be done with locks held, where faulting could sleep or
+// deadlock. Stops at the first page that can't be faulted in,
+// leaving the error for the copy to find.
+void
+uvmtouch(uint64 va, uint64 n, int perm)
+{
+  struct proc *p = myproc();
+  int need = PTE_V | PTE_U | (perm == PTE_W ? PTE_W : 0);
+  uint64 a;
+  pte_t *pte;
+
+  if(n == 0 || va + n < va)
+    return;
+  for(a = PGROUNDDOWN(va); a < va + n && a < MAXVA; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte && (*pte & need) == need)
+      continue;
+    if(uvmfault(p->pagetable, a, perm) < 0)
+      break;
+  }
+}
+
+// Return the physical address of user address va in the
+// current process, having faulted it in with perm, and take
+// a reference to its page (see kdup()) that keeps the page
+// from being freed or swapped out until the caller kfree()s
+// it. Returns 0 if va isn't mapped.
+uint64
+uvmhold(uint64 va, int perm)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint64 pa = 0;
+
+  if(va >= MAXVA)
+    return 0;
+  uvmtouch(va, 1, perm);
+  // other threads may be changing the page table.
+  acquiresleep(&p->mm->lock);
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U)){
+    pa = pteaddr(*pte, va);
+    kdup((void*)pa);
+    pa += va % PGSIZE;
+  }
+  releasesleep(&p->mm->lock);
+  return pa;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -358,7 +701,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = useraddr(pagetable, va0, PTE_W);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -383,7 +726,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = useraddr(pagetable, va0, PTE_R);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -410,7 +753,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = useraddr(pagetable, va0, PTE_R);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -11,6 +11,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/spawn.h"
 
 // from FreeBSD.
 int
@@ -231,47 +232,29 @@ go(int which_child)
         fprintf(2, "pipe failed\n");
         exit(1);
       }
-      int pid1 = fork();
-      if(pid1 == 0){
-        close(bb[0]);
-        close(bb[1]);
-        close(aa[0]);
-        close(1);
-        if(dup(aa[1]) != 1){
-          fprintf(2, "dup failed\n");
-          exit(1);
-        }
-        close(aa[1]);
-        char *args[3] = { "echo", "hi", 0 };
-        exec("grindir/../echo", args);
+      struct spawnact a1[] = {
+        { SPAWN_CLOSE, bb[0], 0 },
+        { SPAWN_CLOSE, bb[1], 0 },
+        { SPAWN_CLOSE, aa[0], 0 },
+        { SPAWN_DUP2, aa[1], 1 },
+        { SPAWN_CLOSE, aa[1], 0 },
+      };
+      char *args1[3] = { "echo", "hi", 0 };
+      if(spawn("grindir/../echo", args1, a1, 5) < 0){
         fprintf(2, "echo: not found\n");
-        exit(2);
-      } else if(pid1 < 0){
-        fprintf(2, "fork failed\n");
         exit(3);
       }
-      int pid2 = fork();
-      if(pid2 == 0){
-        close(aa[1]);
-        close(bb[0]);
-        close(0);
-        if(dup(aa[0]) != 0){
-          fprintf(2, "dup failed\n");
-          exit(4);
-        }
-        close(aa[0]);
-        close(1);
-        if(dup(bb[1]) != 1){
-          fprintf(2, "dup failed\n");
-          exit(5);
-        }
-        close(bb[1]);
-        char *args[2] = { "cat", 0 };
-        exec("/cat", args);
+      struct spawnact a2[] = {
+        { SPAWN_CLOSE, aa[1], 0 },
+        { SPAWN_CLOSE, bb[0], 0 },
+        { SPAWN_DUP2, aa[0], 0 },
+        { SPAWN_CLOSE, aa[0], 0 },
+        { SPAWN_DUP2, bb[1], 1 },
+        { SPAWN_CLOSE, bb[1], 0 },
+      };
+      char *args2[2] = { "cat", 0 };
+      if(spawn("/cat", args2, a2, 6) < 0){
         fprintf(2, "cat: not found\n");
-        exit(6);
-      } else if(pid2 < 0){
-        fprintf(2, "fork failed\n");
         exit(7);
       }
       close(aa[0]);
@@ -0,0 +1,94 @@
+// Spinlock contention benchmark.
+//
+// Forks several children that hammer kmem.lock (sbrk grow and
+// shrink, which kalloc()s and kfree()s pages) and bcache.lock
+// (re-reading a small file through the buffer cache) at the
+// same time.  Reports the total run time and the spread between
+// the first and the last child to finish, which shows how fair
+// the lock is.  Build the kernel with and without TASLOCK=1 to
+// compare the ticket lock with the test-and-set lock.
+//
+// usage: lockbench [nproc [iterations]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NPAGES 8
+
+void
+worker(int iters, int fd)
+{
+  char buf[512];
+  int i, rfd;
+
+  for(i = 0; i < iters; i++){
+    if(sbrk(NPAGES*4096) == (char*)-1){
+      fprintf(2, "lockbench: sbrk failed\n");
+      exit(1);
+    }
+    sbrk(-NPAGES*4096);
+    if((rfd = open("README", O_RDONLY)) < 0){
+      fprintf(2, "lockbench: open README failed\n");
+      exit(1);
+    }
+    read(rfd, buf, sizeof(buf));
+    close(rfd);
+  }
+  // report when this child finished.
+  int t = uptime();
+  write(fd, &t, sizeof(t));
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = 8, iters = 2000;
+  int fds[2], i, t, start, first, last;
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(argc > 2)
+    iters = atoi(argv[2]);
+  if(nproc < 1 || iters < 1){
+    fprintf(2, "usage: lockbench [nproc [iterations]]\n");
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    fprintf(2, "lockbench: pipe failed\n");
+    exit(1);
+  }
+
+  start = uptime();
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      worker(iters, fds[1]);
+    }
+  }
+  close(fds[1]);
+
+  first = last = -1;
+  for(i = 0; i < nproc; i++){
+    if(read(fds[0], &t, sizeof(t)) != sizeof(t))
+      break;
+    if(first < 0)
+      first = t;
+    last = t;
+  }
+  for(i = 0; i < nproc; i++)
+    wait(0);
+
+  printf("lockbench: %d procs x %d iterations: %d ticks, "
+         "first done after %d, last after %d\n",
+         nproc, iters, last - start, first - start, last - start);
+  exit(0);
+}
@@ -1,10 +1,28 @@
 #include "kernel/types.h"
+#include "kernel/time.h"
 #include "user/user.h"
 
+// pingpong [n]: with n, bounce the byte back and forth n times
+// and report the time per round trip, which is mostly two
+// pipe system calls and two context switches on each side.
+
+uint64 nsnow(void) {
+  struct timespec ts;
+
+  clock_gettime(&ts);
+  return ts.sec * NSEC_PER_SEC + ts.nsec;
+}
+
 int main(int argc, char *argv[]) {
-  int pid;
+  int pid, i, n = 0;
   int pipes1[2], pipes2[2];
   char buf[] = {'a'};
+  uint64 t0;
+
+  if (argc > 1 && (n = atoi(argv[1])) < 1) {
+    fprintf(2, "usage: pingpong [n]\n");
+    exit(1);
+  }
   pipe(pipes1);
   pipe(pipes2);
 
@@ -19,6 +37,11 @@ int main(int argc, char *argv[]) {
     pid = getpid();
     close(pipes1[1]);
     close(pipes2[0]);
+    if (n > 0) {
+      while (read(pipes1[0], buf, 1) == 1)
+        write(pipes2[1], buf, 1);
+      exit(0);
+    }
     read(pipes1[0], buf, 1);
     printf("%d: received ping\n", pid);
     write(pipes2[1], buf, 1);
@@ -28,9 +51,21 @@ int main(int argc, char *argv[]) {
     pid = getpid();
     close(pipes1[0]);
     close(pipes2[1]);
+    if (n > 0) {
+      t0 = nsnow();
+      for (i = 0; i < n; i++) {
+        write(pipes1[1], buf, 1);
+        read(pipes2[0], buf, 1);
+      }
+      t0 = nsnow() - t0;
+      close(pipes1[1]);
+      wait(0);
+      printf("pingpong: %d round trips, %d ns each\n", n, (int)(t0 / n));
+      exit(0);
+    }
     write(pipes1[1], buf, 1);
     read(pipes2[0], buf, 1);
     printf("%d: received pong\n", pid);
     exit(0);
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,138 @@
+// Kernel-side copy benchmark.
+//
+// Copies a file of the given size n times to another file and
+// n times into a pipe, first with a read()/write() loop through
+// a user buffer and then with sendfile(), which moves the data
+// inside the kernel, and reports the time each took.
+//
+// usage: sendbench [n [kilobytes]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define TICKS_PER_SEC 10
+
+char buf[4096];
+
+// Kilobytes per second for kb kilobytes that took t ticks.
+int
+rate(int kb, int t)
+{
+  if(t == 0)
+    t = 1;
+  return kb * TICKS_PER_SEC / t;
+}
+
+// Copy all of "sendbench.in" to out, with sendfile() if
+// send is set, else with read() and write().
+void
+copy(int out, int send)
+{
+  int in, n;
+
+  if((in = open("sendbench.in", O_RDONLY)) < 0){
+    fprintf(2, "sendbench: open failed\n");
+    exit(1);
+  }
+  if(send){
+    while((n = sendfile(out, in, -1, sizeof(buf))) > 0)
+      ;
+  } else {
+    while((n = read(in, buf, sizeof(buf))) > 0)
+      if(write(out, buf, n) != n)
+        n = -1;
+  }
+  if(n < 0){
+    fprintf(2, "sendbench: copy failed\n");
+    exit(1);
+  }
+  close(in);
+}
+
+// Ticks to copy the input n times to a new file.
+int
+tofile(int n, int send)
+{
+  int i, fd, start;
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    unlink("sendbench.out");
+    if((fd = open("sendbench.out", O_CREATE|O_WRONLY)) < 0){
+      fprintf(2, "sendbench: create failed\n");
+      exit(1);
+    }
+    copy(fd, send);
+    close(fd);
+  }
+  unlink("sendbench.out");
+  return uptime() - start;
+}
+
+// Ticks to copy the input n times into a pipe, which a
+// child drains.
+int
+topipe(int n, int send)
+{
+  int i, fds[2], start;
+
+  if(pipe(fds) < 0){
+    fprintf(2, "sendbench: pipe failed\n");
+    exit(1);
+  }
+  start = uptime();
+  if(fork() == 0){
+    close(fds[1]);
+    while(read(fds[0], buf, sizeof(buf)) > 0)
+      ;
+    exit(0);
+  }
+  close(fds[0]);
+  for(i = 0; i < n; i++)
+    copy(fds[1], send);
+  close(fds[1]);
+  wait(0);
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 5, kb = 100;
+  int i, fd, rw, sf;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    kb = atoi(argv[2]);
+  if(n < 1 || kb < 1){
+    fprintf(2, "usage: sendbench [n [kilobytes]]\n");
+    exit(1);
+  }
+
+  if((fd = open("sendbench.in", O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    fprintf(2, "sendbench: create failed\n");
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+  for(i = 0; i < kb; i++){
+    if(write(fd, buf, 1024) != 1024){
+      fprintf(2, "sendbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  rw = tofile(n, 0);
+  sf = tofile(n, 1);
+  printf("sendbench: file to file, %d x %d KB: read/write %d ticks (%d KB/s), "
+         "sendfile %d ticks (%d KB/s)\n", n, kb, rw, rate(n*kb, rw), sf, rate(n*kb, sf));
+  rw = topipe(n, 0);
+  sf = topipe(n, 1);
+  printf("sendbench: file to pipe, %d x %d KB: read/write %d ticks (%d KB/s), "
+         "sendfile %d ticks (%d KB/s)\n", n, kb, rw, rate(n*kb, rw), sf, rate(n*kb, sf));
+  unlink("sendbench.in");
+  exit(0);
+}
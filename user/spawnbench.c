@@ -0,0 +1,83 @@
+// Process creation benchmark.
+//
+// Starts a trivial command (this program, with argument "x",
+// which exits at once) n times with fork() and exec(), then n
+// times with spawn(), waiting for each, and reports commands
+// per second for both.  fork() copies the parent's memory,
+// so the parent first grows by the given number of megabytes
+// to show how that cost scales; spawn() doesn't care.
+//
+// usage: spawnbench [n [megabytes]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define TICKS_PER_SEC 10
+
+char *args[] = { "spawnbench", "x", 0 };
+
+// Commands per second for n commands that took t ticks.
+int
+rate(int n, int t)
+{
+  if(t == 0)
+    t = 1;
+  return n * TICKS_PER_SEC / t;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 200, mb = 1;
+  int i, pid, start, tfork, tspawn;
+  char *p;
+
+  if(argc == 2 && strcmp(argv[1], "x") == 0)
+    exit(0);
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    mb = atoi(argv[2]);
+  if(n < 1 || mb < 0){
+    fprintf(2, "usage: spawnbench [n [megabytes]]\n");
+    exit(1);
+  }
+
+  if((p = sbrk(mb * 1024 * 1024)) == (char*)-1){
+    fprintf(2, "spawnbench: sbrk failed\n");
+    exit(1);
+  }
+  memset(p, 1, mb * 1024 * 1024);
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "spawnbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(args[0], args);
+      fprintf(2, "spawnbench: exec failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  tfork = uptime() - start;
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    if(spawn(args[0], args, 0, 0) < 0){
+      fprintf(2, "spawnbench: spawn failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  tspawn = uptime() - start;
+
+  printf("spawnbench: %d commands, %d MB parent: fork+exec %d ticks (%d/s), "
+         "spawn %d ticks (%d/s)\n", n, mb, tfork, rate(n, tfork),
+         tspawn, rate(n, tspawn));
+  exit(0);
+}
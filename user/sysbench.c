@@ -0,0 +1,70 @@
+// System call round-trip benchmark.
+//
+// Times n system calls that do next to nothing (getpid(), made
+// to trap rather than read the USYSCALL page), and then n
+// calls each followed by a read of one word in each of a
+// number of pages. The second shows what the trip costs the
+// user's TLB entries: if the kernel flushes the TLB on every
+// trap, each of those reads misses.
+//
+// usage: sysbench [n [pages]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/time.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+
+int sys_getpid(void);
+
+uint64
+nsnow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(&ts);
+  return ts.sec * NSEC_PER_SEC + ts.nsec;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100000, npages = 32;
+  int i, j, sum = 0;
+  uint64 t0, t1, t2;
+  volatile char *p;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    npages = atoi(argv[2]);
+  if(n < 1 || npages < 1){
+    fprintf(2, "usage: sysbench [n [pages]]\n");
+    exit(1);
+  }
+  if((p = (volatile char*)sbrk(npages * PGSIZE)) == (char*)-1){
+    fprintf(2, "sysbench: sbrk failed\n");
+    exit(1);
+  }
+  for(j = 0; j < npages; j++)
+    p[j * PGSIZE] = 0;
+
+  t0 = nsnow();
+  for(i = 0; i < n; i++)
+    sys_getpid();
+  t1 = nsnow();
+  for(i = 0; i < n; i++){
+    sys_getpid();
+    for(j = 0; j < npages; j++)
+      sum += p[j * PGSIZE];
+  }
+  t2 = nsnow();
+  if(sum != 0)
+    printf("sysbench: memory changed\n");
+
+  printf("sysbench: %d calls: %d ns per call, "
+         "%d ns per call and %d page reads\n", n,
+         (int)((t1 - t0) / n), (int)((t2 - t1) / n), npages);
+  exit(0);
+}
@@ -0,0 +1,72 @@
+// TLB reach benchmark.
+//
+// Builds two regions of the same size: one grown with a single
+// 2MB-aligned sbrk(), which the kernel backs with megapages, and
+// one grown a page at a time, which gets ordinary 4096-byte
+// pages.  Then touches one word in every page of each region,
+// over and over, and reports the ticks each scan took.  With
+// megapages the whole region fits in a few TLB entries.
+//
+// usage: tlbbench [megabytes [passes]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define SUPERPGSIZE (2*1024*1024)
+
+int
+scan(char *p, int n, int passes)
+{
+  int start, i, off;
+  volatile char *v = p;
+  int sum = 0;
+
+  start = uptime();
+  for(i = 0; i < passes; i++)
+    for(off = 0; off < n; off += PGSIZE)
+      sum += v[off];
+  if(sum != 0)
+    printf("tlbbench: memory not zeroed\n");
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 8, passes = 200;
+  int n, i, pad, big, small;
+  char *a, *b;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(argc > 2)
+    passes = atoi(argv[2]);
+  if(mb < 2 || passes < 1){
+    fprintf(2, "usage: tlbbench [megabytes [passes]]\n");
+    exit(1);
+  }
+  n = mb * 1024 * 1024;
+
+  // align the break so the kernel can use megapages.
+  pad = SUPERPGSIZE - (uint64)sbrk(0) % SUPERPGSIZE;
+  if(sbrk(pad) == (char*)-1 || (a = sbrk(n)) == (char*)-1){
+    fprintf(2, "tlbbench: sbrk failed\n");
+    exit(1);
+  }
+
+  b = sbrk(0);
+  for(i = 0; i < n; i += PGSIZE){
+    if(sbrk(PGSIZE) == (char*)-1){
+      fprintf(2, "tlbbench: sbrk failed\n");
+      exit(1);
+    }
+  }
+
+  big = scan(a, n, passes);
+  small = scan(b, n, passes);
+  printf("tlbbench: %d MB x %d passes: megapages %d ticks, "
+         "4K pages %d ticks\n", mb, passes, big, small);
+  exit(0);
+}
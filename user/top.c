@@ -0,0 +1,113 @@
+// Show CPU utilization per process and per hart.
+//
+// usage: top [refreshes [interval]]
+//
+// Samples getprocinfo() every interval ticks (default 10,
+// about a second) and prints how busy each hart was and how
+// much CPU time each process used during the interval.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/memlayout.h"
+#include "kernel/procinfo.h"
+#include "user/user.h"
+
+static char *states[] = {
+  [0] "unused",
+  [1] "sleep ",
+  [2] "runble",
+  [3] "run   ",
+  [4] "zombie",
+};
+
+struct procinfo pi0[NPROC], pi1[NPROC];
+struct hartinfo hi0[NCPU], hi1[NCPU];
+
+// print x/total as a percentage with one decimal.
+void
+percent(uint64 x, uint64 total)
+{
+  int p;
+
+  if(total == 0)
+    total = 1;
+  p = (x * 1000) / total;
+  printf("%d.%d%%", p / 10, p % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int refreshes = 10, interval = 10;
+  int n0, n1, i, j;
+
+  if(argc > 1)
+    refreshes = atoi(argv[1]);
+  if(argc > 2)
+    interval = atoi(argv[2]);
+  if(interval < 1){
+    fprintf(2, "usage: top [refreshes [interval]]\n");
+    exit(1);
+  }
+
+  n0 = getprocinfo(pi0, NPROC, hi0, NCPU);
+  if(n0 < 0){
+    fprintf(2, "top: getprocinfo failed\n");
+    exit(1);
+  }
+
+  while(refreshes-- > 0){
+    sleep(interval);
+    n1 = getprocinfo(pi1, NPROC, hi1, NCPU);
+    if(n1 < 0){
+      fprintf(2, "top: getprocinfo failed\n");
+      exit(1);
+    }
+
+    // wall-clock length of the interval, taken from the
+    // hart that accounted for the most time.
+    uint64 wall = 0;
+    for(i = 0; i < NCPU; i++){
+      uint64 t = (hi1[i].busy + hi1[i].idle) - (hi0[i].busy + hi0[i].idle);
+      if(t > wall)
+        wall = t;
+    }
+
+    printf("\nhart   busy\n");
+    for(i = 0; i < NCPU; i++){
+      uint64 busy = hi1[i].busy - hi0[i].busy;
+      uint64 idle = hi1[i].idle - hi0[i].idle;
+      if(busy + idle == 0)
+        continue;  // not running
+      printf("%d      ", i);
+      percent(busy, busy + idle);
+      printf("\n");
+    }
+
+    printf("pid    state  cpu     user ms  sys ms  name\n");
+    for(i = 0; i < n1; i++){
+      uint64 u = pi1[i].utime, s = pi1[i].stime;
+      // subtract the previous sample of the same process, if any.
+      for(j = 0; j < n0; j++){
+        if(pi0[j].pid == pi1[i].pid){
+          u -= pi0[j].utime;
+          s -= pi0[j].stime;
+          break;
+        }
+      }
+      char *state = "???";
+      if(pi1[i].state >= 0 && pi1[i].state < sizeof(states)/sizeof(states[0]))
+        state = states[pi1[i].state];
+      printf("%d\t%s ", pi1[i].pid, state);
+      percent(u + s, wall);
+      printf("\t%d\t%d\t%s\n", (int)(pi1[i].utime / (MTIME_FREQ/1000)),
+             (int)(pi1[i].stime / (MTIME_FREQ/1000)), pi1[i].name);
+    }
+
+    memmove(pi0, pi1, sizeof(pi1));
+    memmove(hi0, hi1, sizeof(hi1));
+    n0 = n1;
+  }
+  exit(0);
+}
@@ -1,8 +1,41 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/ring.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/time.h"
 #include "user/user.h"
 
+int sys_getpid(void);
+int sys_clock_gettime(struct timespec*);
+
+// getpid() and clock_gettime() read the USYSCALL page, when
+// it has the answer, rather than trapping.
+
+int
+getpid(void)
+{
+  struct usyscall *u = (struct usyscall*)USYSCALL;
+
+  return u->pid ? u->pid : sys_getpid();
+}
+
+// Time since boot.
+int
+clock_gettime(struct timespec *ts)
+{
+  struct usyscall *u = (struct usyscall*)USYSCALL;
+  uint64 t;
+
+  if(u->freq == 0)
+    return sys_clock_gettime(ts);
+  t = r_time();
+  ts->sec = t / u->freq;
+  ts->nsec = (t % u->freq) * NSEC_PER_SEC / u->freq;
+  return 0;
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -134,3 +167,116 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Locks for threads and processes sharing memory, built on
+// futexes so that waiting doesn't spin. Zeroed memory is an
+// unlocked mutex, a condition variable, and (but for n) a barrier.
+
+// m->state is 0 if unlocked, 1 if locked, 2 if locked and
+// there may be waiters to wake up.
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __sync_synchronize();
+    m->state = 0;
+    futex_wake(&m->state, 1);
+  }
+}
+
+// Release m, wait for cond_signal() or cond_broadcast() on c,
+// and lock m again. May also return early, so callers must
+// check their condition in a loop.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);
+}
+
+void
+barrier_init(struct barrier *b, int n)
+{
+  b->n = n;
+  b->count = 0;
+  b->gen = 0;
+}
+
+// Wait until all b->n threads have called barrier_wait().
+void
+barrier_wait(struct barrier *b)
+{
+  int gen = b->gen;
+
+  if(__sync_add_and_fetch(&b->count, 1) == b->n){
+    b->count = 0;
+    __sync_fetch_and_add(&b->gen, 1);
+    futex_wake(&b->gen, 0x7fffffff);
+  } else {
+    while(*(volatile int*)&b->gen == gen)
+      futex_wait(&b->gen, gen);
+  }
+}
+
+// Queue system call num(a0, a1, a2) on r for the next
+// ring_enter(); data comes back in its cqe. Returns the sqe,
+// for calls with more arguments, or 0 if r is full.
+struct sqe*
+ring_sqe(struct ring *r, int num, uint64 a0, uint64 a1, uint64 a2, uint64 data)
+{
+  struct sqe *s;
+
+  if(r->sqtail - r->sqhead == r->n)
+    return 0;
+  s = &RING_SQ(r)[r->sqtail & (r->n - 1)];
+  memset(s, 0, sizeof(*s));
+  s->num = num;
+  s->arg[0] = a0;
+  s->arg[1] = a1;
+  s->arg[2] = a2;
+  s->data = data;
+  r->sqtail++;
+  return s;
+}
+
+// Take the next completion off r, or return 0 if there is
+// none. The cqe stays valid until the next ring_enter().
+struct cqe*
+ring_cqe(struct ring *r)
+{
+  if(r->cqhead == r->cqtail)
+    return 0;
+  return &RING_CQ(r)[r->cqhead++ & (r->n - 1)];
+}
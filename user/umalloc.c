@@ -21,8 +21,27 @@ typedef union header Header;
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+// held by malloc() and free(), which threads (see uthread.c)
+// may call at the same time.
+static int heaplock;
+
+static void
+lockheap(void)
+{
+  while(__sync_lock_test_and_set(&heaplock, 1) != 0)
+    ;
+  __sync_synchronize();
+}
+
+static void
+unlockheap(void)
+{
+  __sync_synchronize();
+  __sync_lock_release(&heaplock);
+}
+
+static void
+freelocked(void *ap)
 {
   Header *bp, *p;
 
@@ -56,12 +75,20 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  freelocked((void*)(hp + 1));
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+void
+free(void *ap)
+{
+  lockheap();
+  freelocked(ap);
+  unlockheap();
+}
+
+static void*
+malloclocked(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
@@ -88,3 +115,14 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+void*
+malloc(uint nbytes)
+{
+  void *p;
+
+  lockheap();
+  p = malloclocked(nbytes);
+  unlockheap();
+  return p;
+}
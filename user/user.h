@@ -1,5 +1,29 @@
 struct stat;
 struct rtcdate;
+struct procinfo;
+struct hartinfo;
+struct spawnact;
+struct ring;
+struct sqe;
+struct cqe;
+struct iovec;
+struct pollfd;
+struct timespec;
+
+// ulib.c locks.
+struct mutex {
+  int state;
+};
+
+struct cond {
+  int seq;
+};
+
+struct barrier {
+  int n;      // threads to wait for
+  int count;  // threads waiting
+  int gen;
+};
 
 // system calls
 int fork(void);
@@ -23,6 +47,27 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int getprocinfo(struct procinfo*, int, struct hartinfo*, int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int spawn(char*, char**, struct spawnact*, int);
+int clone(void(*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+struct ring* ring_setup(int);
+int ring_enter(void);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int sendfile(int, int, int, int);
+int splice(int, int, int);
+int fcntl(int, int, int);
+int poll(struct pollfd*, int, int);
+int clock_gettime(struct timespec*);
+int nanosleep(struct timespec*);
+int fsync(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +85,16 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+void barrier_init(struct barrier*, int);
+void barrier_wait(struct barrier*);
+struct sqe* ring_sqe(struct ring*, int, uint64, uint64, uint64, uint64);
+struct cqe* ring_cqe(struct ring*);
+
+// uthread.c
+int uthread_create(void(*)(void*), void*);
+int uthread_join(int, int*);
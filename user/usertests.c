@@ -7,6 +7,11 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/spawn.h"
+#include "kernel/ring.h"
+#include "kernel/uio.h"
+#include "kernel/poll.h"
+#include "kernel/time.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -680,6 +685,41 @@ exectest(char *s)
 
 }
 
+// a running program can't be written or truncated, and a
+// file open for writing can't be run.
+void
+textbusy(char *s)
+{
+  char *echoargv[] = { "echo", "OK", 0 };
+  int fd, pid, xstatus;
+
+  if((fd = open("usertests", O_RDWR)) >= 0 ||
+     (fd = open("usertests", O_RDONLY|O_TRUNC)) >= 0){
+    printf("%s: opened running program for writing\n", s);
+    exit(1);
+  }
+  if((fd = open("echo", O_WRONLY)) < 0){
+    printf("%s: open echo failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    exec("echo", echoargv);
+    exit(7);
+  }
+  wait(&xstatus);
+  close(fd);
+  if(xstatus != 7){
+    printf("%s: ran a file open for writing\n", s);
+    exit(1);
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -1065,6 +1105,119 @@ sharedfd(char *s)
   }
 }
 
+// several processes read the same file and walk through
+// the same directory at once, while another process
+// modifies that directory. also two processes read through
+// one shared descriptor, which must not hand out the same
+// offset twice.
+void
+sharedread(char *s)
+{
+  enum { NCHILD = 4, N = 20, SZ = 4*BSIZE };
+  int fd, i, j, k, n, tot, xstatus;
+  static char rbuf[SZ];
+
+  unlink("srdir/srfile");
+  unlink("srdir");
+  if(mkdir("srdir") < 0){
+    printf("%s: mkdir srdir failed\n", s);
+    exit(1);
+  }
+  fd = open("srdir/srfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create srdir/srfile failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = 'a' + i % 23;
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write srfile failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < NCHILD + 1; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if(i == NCHILD){
+        // writer: create and remove entries in srdir.
+        char nm[] = "srdir/xx";
+        for(j = 0; j < N; j++){
+          nm[6] = 'a' + j % 26;
+          nm[7] = '0' + i;
+          fd = open(nm, O_CREATE|O_RDWR);
+          if(fd < 0){
+            printf("%s: create %s failed\n", s, nm);
+            exit(1);
+          }
+          close(fd);
+          unlink(nm);
+        }
+        exit(0);
+      }
+      for(j = 0; j < N; j++){
+        struct stat st;
+        fd = open("srdir/../srdir/srfile", O_RDONLY);
+        if(fd < 0){
+          printf("%s: open srfile failed\n", s);
+          exit(1);
+        }
+        if(fstat(fd, &st) < 0 || st.size != SZ){
+          printf("%s: fstat srfile failed\n", s);
+          exit(1);
+        }
+        if(read(fd, rbuf, SZ) != SZ){
+          printf("%s: read srfile failed\n", s);
+          exit(1);
+        }
+        for(k = 0; k < SZ; k++){
+          if(rbuf[k] != 'a' + k % 23){
+            printf("%s: srfile has wrong content\n", s);
+            exit(1);
+          }
+        }
+        close(fd);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD + 1; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+
+  // parent and child read through one descriptor.
+  fd = open("srdir/srfile", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open srfile failed\n", s);
+    exit(1);
+  }
+  int pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  tot = 0;
+  while((n = read(fd, rbuf, 100)) > 0)
+    tot += n;
+  if(pid == 0)
+    exit(tot);
+  wait(&xstatus);
+  close(fd);
+  if(tot + xstatus != SZ){
+    printf("%s: shared descriptor read %d bytes, expected %d\n", s, tot + xstatus, SZ);
+    exit(1);
+  }
+
+  unlink("srdir/srfile");
+  unlink("srdir");
+}
+
 // four processes write different files at the same
 // time, to test block allocation.
 void
@@ -1875,6 +2028,177 @@ dirfile(char *s)
   close(fd);
 }
 
+// more files open at once than the old fixed file table
+// (100 entries) could hold.
+void
+manyfiles(char *s)
+{
+  enum { NCHILD = 10, NOPEN = 10 };
+  int fds[2], go[2], i, j, pid, xstatus;
+  char c;
+
+  if(pipe(fds) < 0 || pipe(go) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(go[1]);
+      for(j = 0; j < NOPEN; j++){
+        if(open("README", 0) < 0){
+          printf("%s: open failed\n", s);
+          exit(1);
+        }
+      }
+      write(fds[1], "x", 1);
+      close(fds[1]);
+      read(go[0], &c, 1); // wait until the parent closes go[1].
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  for(i = 0; i < NCHILD; i++){
+    if(read(fds[0], &c, 1) != 1){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+  close(go[1]);
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  close(fds[0]);
+  close(go[0]);
+}
+
+// mmap() a file: private and shared mappings, write-back
+// on munmap(), inheritance by fork(), partial munmap().
+void
+mmapfile(char *s)
+{
+  enum { SZ = 3*PGSIZE + 100 };
+  char *f = "mmapfile";
+  char *p, *q;
+  int fd, i, pid, xstatus;
+  static char buf[SZ];
+
+  for(i = 0; i < SZ; i++)
+    buf[i] = 'a' + i % 23;
+  unlink(f);
+  if((fd = open(f, O_CREATE|O_RDWR)) < 0 || write(fd, buf, SZ) != SZ){
+    printf("%s: create %s failed\n", s, f);
+    exit(1);
+  }
+
+  // private: writes must not reach the file.
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(p[i] != buf[i]){
+      printf("%s: wrong byte %d in private mapping\n", s, i);
+      exit(1);
+    }
+  }
+  if(p[SZ] != 0){
+    printf("%s: mapping not zero past end of file\n", s);
+    exit(1);
+  }
+  p[0] = 'X';
+  if(munmap(p, SZ) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  // shared: writes go back to the file, also the child's.
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  p[1] = 'Y';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(p[1] != 'Y' || p[SZ-1] != buf[SZ-1])
+      exit(1);
+    p[2*PGSIZE] = 'Z';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+  // drop the first page only; the rest stays mapped.
+  if(munmap(p, PGSIZE) != 0 || p[PGSIZE] != buf[PGSIZE]){
+    printf("%s: partial munmap failed\n", s);
+    exit(1);
+  }
+  if(munmap(p + PGSIZE, SZ - PGSIZE) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  close(fd);
+  if((fd = open(f, O_RDONLY)) < 0 || read(fd, buf, SZ) != SZ){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink(f);
+  if(buf[0] != 'a' || buf[1] != 'Y' || buf[2*PGSIZE] != 'Z'){
+    printf("%s: file has wrong contents after munmap\n", s);
+    exit(1);
+  }
+
+  // anonymous memory.
+  p = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  q = sbrk(0);
+  if(p == (char*)-1 || p < q || p[0] != 0 || p[PGSIZE] != 0){
+    printf("%s: anonymous mmap failed\n", s);
+    exit(1);
+  }
+  p[PGSIZE] = 1;
+  munmap(p, 2*PGSIZE);
+
+  // shared anonymous memory is shared with a child, both the
+  // pages touched before fork() and those that weren't.
+  p = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1){
+    printf("%s: shared anonymous mmap failed\n", s);
+    exit(1);
+  }
+  p[0] = 1;
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[0] = 2;
+    p[PGSIZE] = 3;
+    exit(0);
+  }
+  wait(0);
+  if(p[0] != 2 || p[PGSIZE] != 3){
+    printf("%s: child's writes not seen\n", s);
+    exit(1);
+  }
+  munmap(p, 2*PGSIZE);
+}
+
 // test that iput() is called at the end of _namei().
 // also tests empty file names.
 void
@@ -2076,6 +2400,839 @@ sbrkmuch(char *s)
   }
 }
 
+// memory the kernel backs with 2MB megapages must survive fork
+// and being shrunk part of the way into a megapage.
+void
+megapage(char *s)
+{
+  enum { SUPER=2*1024*1024 };
+  char *oldbrk, *a;
+  int i, pid, xstatus;
+
+  oldbrk = sbrk(0);
+  sbrk(SUPER - (uint64)oldbrk % SUPER);
+  a = sbrk(2*SUPER);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 2*SUPER; i += PGSIZE)
+    a[i] = i / PGSIZE;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < 2*SUPER; i += PGSIZE){
+      if(a[i] != (char)(i / PGSIZE)){
+        printf("%s: child saw wrong data at %d\n", s, i);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  // free the second megapage and cut into the first.
+  sbrk(-(SUPER + 3*PGSIZE));
+  for(i = 0; i < SUPER - 3*PGSIZE; i += PGSIZE){
+    if(a[i] != (char)(i / PGSIZE)){
+      printf("%s: wrong data at %d after shrink\n", s, i);
+      exit(1);
+    }
+  }
+  sbrk(-(sbrk(0) - oldbrk));
+}
+
+// program text is paged in read-only; writing it must fault.
+void
+textwrite(char *s)
+{
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid == 0){
+    volatile int *addr = (int *) 0;
+    *addr = 10;
+    exit(1);
+  } else if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != -1)
+    exit(1);
+}
+
+// spawn() with file actions, and a spawn() that fails.
+void
+spawntest(char *s)
+{
+  int fds[2], pid, xstatus;
+  char buf[8];
+  char *args[] = { "echo", "hi", 0 };
+  struct spawnact act[] = {
+    { SPAWN_DUP2, 0, 1 },
+    { SPAWN_CLOSE, 0, 0 },
+    { SPAWN_CLOSE, 0, 0 },
+  };
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  act[0].fd = fds[1];
+  act[1].fd = fds[0];
+  act[2].fd = fds[1];
+  if((pid = spawn("echo", args, act, 3)) < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  memset(buf, 0, sizeof(buf));
+  if(read(fds[0], buf, sizeof(buf)-1) != 3 || strcmp(buf, "hi\n") != 0){
+    printf("%s: wrong output \"%s\"\n", s, buf);
+    exit(1);
+  }
+  close(fds[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: echo failed\n", s);
+    exit(1);
+  }
+
+  if(spawn("nosuchprogram", args, 0, 0) != -1){
+    printf("%s: spawn of a missing program succeeded\n", s);
+    exit(1);
+  }
+  // the failed child must have been cleaned up already.
+  if(wait(0) != -1){
+    printf("%s: failed spawn left a child\n", s);
+    exit(1);
+  }
+  act[0].fd = 100;
+  if(spawn("echo", args, act, 1) != -1){
+    printf("%s: spawn with a bad fd succeeded\n", s);
+    exit(1);
+  }
+}
+
+int tcount;
+char *tbrk;
+int tfd = -1;
+
+void
+tcountfn(void *arg)
+{
+  for(int i = 0; i < 10000; i++)
+    __sync_fetch_and_add(&tcount, 1);
+}
+
+void
+tsbrkfn(void *arg)
+{
+  tbrk = sbrk(2*4096);
+  if(tbrk != (char*)-1)
+    memset(tbrk, 7, 2*4096);
+  tfd = open("README", O_RDONLY);
+  exit(*(int*)arg);
+}
+
+// threads made with clone() share memory and open files.
+void
+threads(char *s)
+{
+  int tids[4], i, st, arg = 5;
+  char buf[4];
+
+  for(i = 0; i < 4; i++){
+    if((tids[i] = uthread_create(tcountfn, 0)) < 0){
+      printf("%s: uthread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if(uthread_join(tids[i], 0) < 0){
+      printf("%s: uthread_join failed\n", s);
+      exit(1);
+    }
+  }
+  if(tcount != 4*10000){
+    printf("%s: count %d, not %d\n", s, tcount, 4*10000);
+    exit(1);
+  }
+
+  // memory grown and a file opened by a thread are
+  // there for the others.
+  if((tids[0] = uthread_create(tsbrkfn, &arg)) < 0){
+    printf("%s: uthread_create failed\n", s);
+    exit(1);
+  }
+  // wait() is for processes, not threads.
+  if(wait(0) != -1){
+    printf("%s: wait() returned a thread\n", s);
+    exit(1);
+  }
+  if(uthread_join(tids[0], &st) < 0 || st != 5){
+    printf("%s: join failed, status %d\n", s, st);
+    exit(1);
+  }
+  if(tbrk == (char*)-1 || sbrk(0) != tbrk + 2*4096){
+    printf("%s: sbrk in thread not seen\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 2*4096; i++){
+    if(tbrk[i] != 7){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(tfd < 0 || read(tfd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: file opened by thread not usable\n", s);
+    exit(1);
+  }
+  close(tfd);
+  if(join(tids[0], 0) != -1){
+    printf("%s: joined twice\n", s);
+    exit(1);
+  }
+}
+
+int tpipe[2];
+int tgot;
+
+void
+tpipefn(void *arg)
+{
+  char c;
+
+  tgot = read(tpipe[0], &c, 1);
+  exit(0);
+}
+
+// a thread closing a descriptor that another thread is
+// reading leaves the read to finish with the file.
+void
+threadclose(char *s)
+{
+  int tid;
+
+  if(pipe(tpipe) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if((tid = uthread_create(tpipefn, 0)) < 0){
+    printf("%s: uthread_create failed\n", s);
+    exit(1);
+  }
+  sleep(2);  // until the thread is in read()
+  if(close(tpipe[0]) != 0 || close(tpipe[0]) != -1){
+    printf("%s: close failed\n", s);
+    exit(1);
+  }
+  if(write(tpipe[1], "x", 1) != 1 || uthread_join(tid, 0) < 0 || tgot != 1){
+    printf("%s: read after close got %d\n", s, tgot);
+    exit(1);
+  }
+  close(tpipe[1]);
+}
+
+struct mutex lmu;
+struct cond lcond;
+struct barrier lbar;
+int lcount, lready, lphase[4];
+
+void
+lockfn(void *arg)
+{
+  int me = (int)(uint64)arg;
+
+  for(int i = 0; i < 2000; i++){
+    mutex_lock(&lmu);
+    lcount++;
+    mutex_unlock(&lmu);
+  }
+
+  // every thread must see every other finish each round.
+  for(int r = 1; r <= 20; r++){
+    lphase[me] = r;
+    barrier_wait(&lbar);
+    for(int i = 0; i < 4; i++)
+      if(lphase[i] < r)
+        exit(1);
+    barrier_wait(&lbar);
+  }
+
+  mutex_lock(&lmu);
+  while(!lready)
+    cond_wait(&lcond, &lmu);
+  mutex_unlock(&lmu);
+  exit(0);
+}
+
+// mutexes, barriers and condition variables on futexes.
+void
+ulocks(char *s)
+{
+  int tids[4], i, st, v = 1;
+
+  if(futex_wait(&v, 2) != -1){
+    printf("%s: futex_wait slept with the wrong value\n", s);
+    exit(1);
+  }
+  if(futex_wake(&v, 1) != 0){
+    printf("%s: futex_wake woke someone\n", s);
+    exit(1);
+  }
+
+  barrier_init(&lbar, 4);
+  for(i = 0; i < 4; i++){
+    if((tids[i] = uthread_create(lockfn, (void*)(uint64)i)) < 0){
+      printf("%s: uthread_create failed\n", s);
+      exit(1);
+    }
+  }
+  sleep(2);
+  mutex_lock(&lmu);
+  lready = 1;
+  cond_broadcast(&lcond);
+  mutex_unlock(&lmu);
+  for(i = 0; i < 4; i++){
+    if(uthread_join(tids[i], &st) < 0 || st != 0){
+      printf("%s: thread failed\n", s);
+      exit(1);
+    }
+  }
+  if(lcount != 4*2000){
+    printf("%s: count %d, not %d\n", s, lcount, 4*2000);
+    exit(1);
+  }
+}
+
+// batches of system calls through ring_enter().
+void
+ringtest(char *s)
+{
+  struct ring *r;
+  struct cqe *c;
+  char buf[8];
+  int i, fd, pid = getpid();
+
+  if(ring_setup(3) != (struct ring*)-1 || ring_setup(RINGMAX*2) != (struct ring*)-1){
+    printf("%s: ring_setup accepted a bad size\n", s);
+    exit(1);
+  }
+  if((r = ring_setup(8)) == (struct ring*)-1){
+    printf("%s: ring_setup failed\n", s);
+    exit(1);
+  }
+  if(ring_setup(8) != (struct ring*)-1){
+    printf("%s: second ring_setup succeeded\n", s);
+    exit(1);
+  }
+
+  unlink("ringf");
+  ring_sqe(r, SYS_open, (uint64)"ringf", O_CREATE|O_RDWR, 0, 1);
+  ring_sqe(r, SYS_getpid, 0, 0, 0, 2);
+  ring_sqe(r, SYS_exit, 1, 0, 0, 3);
+  if(ring_enter() != 3){
+    printf("%s: ring_enter didn't run all three\n", s);
+    exit(1);
+  }
+  fd = -1;
+  for(i = 1; (c = ring_cqe(r)) != 0; i++){
+    if(c->data != i){
+      printf("%s: completion out of order\n", s);
+      exit(1);
+    }
+    if((i == 1 && (fd = c->res) < 0) || (i == 2 && c->res != pid) || (i == 3 && c->res != -1)){
+      printf("%s: call %d returned %d\n", s, i, c->res);
+      exit(1);
+    }
+  }
+  if(i != 4){
+    printf("%s: %d completions\n", s, i - 1);
+    exit(1);
+  }
+
+  // a write and a read back, and then a full completion queue.
+  ring_sqe(r, SYS_write, fd, (uint64)"ringing", 7, 0);
+  ring_sqe(r, SYS_close, fd, 0, 0, 0);
+  ring_sqe(r, SYS_open, (uint64)"ringf", O_RDONLY, 0, 0);
+  if(ring_enter() != 3 || (c = ring_cqe(r)) == 0 || c->res != 7 ||
+     ring_cqe(r) == 0 || (c = ring_cqe(r)) == 0 || (fd = c->res) < 0){
+    printf("%s: write through ring failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 8; i++)
+    ring_sqe(r, SYS_getpid, 0, 0, 0, 0);
+  if(ring_enter() != 8 || ring_sqe(r, SYS_read, fd, (uint64)buf, 7, 0) == 0){
+    printf("%s: ring_enter of a full ring failed\n", s);
+    exit(1);
+  }
+  if(ring_enter() != 0){
+    printf("%s: ring_enter overflowed the completions\n", s);
+    exit(1);
+  }
+  while(ring_cqe(r) != 0)
+    ;
+  if(ring_enter() != 1 || (c = ring_cqe(r)) == 0 || c->res != 7 || memcmp(buf, "ringing", 7) != 0){
+    printf("%s: read through ring failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("ringf");
+}
+
+// readv(), writev(), pread() and pwrite().
+void
+vecio(char *s)
+{
+  static char big[5000], got[5000];
+  struct iovec iov[3];
+  char hdr[4], tail[4];
+  int fd, i, fds[2];
+
+  for(i = 0; i < sizeof(big); i++)
+    big[i] = 'a' + i % 23;
+  unlink("vecio");
+  if((fd = open("vecio", O_CREATE|O_RDWR)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  // spans more than one log transaction.
+  iov[0].base = "head";
+  iov[0].len = 4;
+  iov[1].base = big;
+  iov[1].len = sizeof(big);
+  iov[2].base = "tail";
+  iov[2].len = 4;
+  if(writev(fd, iov, 3) != 4 + sizeof(big) + 4){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  // nothing to write, in whole or at the end.
+  iov[0].len = 0;
+  iov[1].len = 0;
+  if(write(fd, big, 0) != 0 || writev(fd, iov, 2) != 0){
+    printf("%s: empty write failed\n", s);
+    exit(1);
+  }
+
+  // pread() and pwrite() leave the offset alone.
+  if(pread(fd, tail, 4, 4 + sizeof(big)) != 4 || memcmp(tail, "tail", 4) != 0){
+    printf("%s: pread failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "HEAD", 4, 0) != 4 || pwrite(fd, "x", 1, 100000) != -1){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "!", 1) != 1 || pread(fd, tail, 1, 4 + sizeof(big) + 4) != 1 || tail[0] != '!'){
+    printf("%s: pwrite moved the offset\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if((fd = open("vecio", O_RDONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  iov[0].base = hdr;
+  iov[0].len = 4;
+  iov[1].base = got;
+  iov[1].len = sizeof(got);
+  iov[2].base = tail;
+  iov[2].len = 4;
+  if(readv(fd, iov, 3) != 4 + sizeof(got) + 4 || memcmp(hdr, "HEAD", 4) != 0 ||
+     memcmp(got, big, sizeof(big)) != 0 || memcmp(tail, "tail", 4) != 0){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(readv(fd, iov, MAXIOV+1) != -1){
+    printf("%s: readv took too many buffers\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("vecio");
+
+  // no offsets on pipes.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  iov[0].base = "ab";
+  iov[0].len = 2;
+  iov[1].base = "cd";
+  iov[1].len = 2;
+  if(pread(fds[0], hdr, 1, 0) != -1 || writev(fds[1], iov, 2) != 4 ||
+     read(fds[0], hdr, 4) != 4 || memcmp(hdr, "abcd", 4) != 0){
+    printf("%s: vectored pipe i/o failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// sendfile() and splice() between files and pipes.
+void
+sendfiletest(char *s)
+{
+  static char data[6000], got[6000];
+  int i, n, in, out, fds[2];
+
+  for(i = 0; i < sizeof(data); i++)
+    data[i] = 'A' + i % 26;
+  unlink("sendf.in");
+  unlink("sendf.out");
+  if((in = open("sendf.in", O_CREATE|O_RDWR)) < 0 || write(in, data, sizeof(data)) != sizeof(data)){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(in);
+
+  in = open("sendf.in", O_RDONLY);
+  out = open("sendf.out", O_CREATE|O_RDWR);
+  if(in < 0 || out < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  // at an offset, across a page boundary, leaving in's offset.
+  if(sendfile(out, in, 1000, 4000) != 4000){
+    printf("%s: sendfile at offset failed\n", s);
+    exit(1);
+  }
+  // then from in's offset, stopping at the end of the file.
+  if(sendfile(out, in, -1, 10000) != sizeof(data) || sendfile(out, in, -1, 10) != 0){
+    printf("%s: sendfile from offset failed\n", s);
+    exit(1);
+  }
+  if(pread(out, got, 4000, 0) != 4000 || memcmp(got, data + 1000, 4000) != 0 ||
+     pread(out, got, sizeof(got), 4000) != sizeof(got) || memcmp(got, data, sizeof(data)) != 0){
+    printf("%s: sendfile copied the wrong data\n", s);
+    exit(1);
+  }
+
+  // from a pipe into a file.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(sendfile(out, fds[0], -1, 10) != -1){
+    printf("%s: sendfile from a pipe\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "spliced", 7) != 7 || splice(fds[0], out, 100) != 7 ||
+     pread(out, got, 7, 10000) != 7 || memcmp(got, "spliced", 7) != 0){
+    printf("%s: splice from a pipe failed\n", s);
+    exit(1);
+  }
+  close(out);
+
+  // from a file into a pipe, more than it holds at once.
+  if(fork() == 0){
+    close(fds[0]);
+    if(sendfile(fds[1], in, 0, sizeof(data)) != sizeof(data))
+      exit(1);
+    exit(0);
+  }
+  close(fds[1]);
+  for(i = 0; i < sizeof(got); i += n){
+    if((n = read(fds[0], got + i, sizeof(got) - i)) <= 0){
+      printf("%s: short read from pipe\n", s);
+      exit(1);
+    }
+  }
+  wait(&n);
+  if(n != 0 || memcmp(got, data, sizeof(data)) != 0){
+    printf("%s: sendfile to a pipe failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(in);
+  unlink("sendf.in");
+  unlink("sendf.out");
+}
+
+// O_NONBLOCK pipes, and poll().
+void
+polltest(char *s)
+{
+  static char buf[600];
+  struct pollfd pfd[3];
+  int a[2], b[2], t0, n;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+
+  if(fcntl(a[0], F_SETFL, O_NONBLOCK) != 0 || fcntl(a[0], F_GETFL, 0) != O_NONBLOCK ||
+     fcntl(a[1], F_SETFL, O_NONBLOCK) != 0){
+    printf("%s: fcntl failed\n", s);
+    exit(1);
+  }
+  if(read(a[0], buf, 1) != -1){
+    printf("%s: non-blocking read of an empty pipe\n", s);
+    exit(1);
+  }
+  // a pipe holds 512 bytes.
+  if((n = write(a[1], buf, sizeof(buf))) <= 0 || n == sizeof(buf) || write(a[1], buf, 1) != -1){
+    printf("%s: non-blocking write to a full pipe\n", s);
+    exit(1);
+  }
+
+  pfd[0].fd = a[1];
+  pfd[0].events = POLLOUT;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  pfd[2].fd = 99;
+  pfd[2].events = POLLIN;
+  if(poll(pfd, 2, 0) != 0 || pfd[0].revents != 0 || pfd[1].revents != 0){
+    printf("%s: poll found a ready fd\n", s);
+    exit(1);
+  }
+  if(poll(pfd, 3, 0) != 1 || pfd[2].revents != POLLNVAL){
+    printf("%s: poll of a bad fd\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  if(poll(pfd, 2, 2) != 0 || uptime() - t0 < 2){
+    printf("%s: poll didn't time out\n", s);
+    exit(1);
+  }
+
+  // one process waits on two pipes, for whichever is first.
+  if(fork() == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    sleep(2);
+    read(a[0], buf, sizeof(buf));
+    exit(0);
+  }
+  if(poll(pfd, 2, -1) != 1 || pfd[1].revents != POLLIN || read(b[0], buf, 1) != 1){
+    printf("%s: poll missed input\n", s);
+    exit(1);
+  }
+  if(poll(pfd, 2, -1) != 1 || pfd[0].revents != POLLOUT){
+    printf("%s: poll missed space\n", s);
+    exit(1);
+  }
+  wait(0);
+  close(b[1]);
+  if(poll(pfd + 1, 1, -1) != 1 || pfd[1].revents != POLLHUP || read(b[0], buf, 1) != 0){
+    printf("%s: poll missed the end\n", s);
+    exit(1);
+  }
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+}
+
+uint64
+nsnow(void)
+{
+  struct timespec ts;
+
+  if(clock_gettime(&ts) < 0){
+    printf("clock_gettime failed\n");
+    exit(1);
+  }
+  return ts.sec * NSEC_PER_SEC + ts.nsec;
+}
+
+int tpid;
+
+void
+tpidfn(void *arg)
+{
+  tpid = getpid();
+  exit(0);
+}
+
+// clock_gettime(), nanosleep(), and getpid() from the USYSCALL page.
+void
+clocktest(char *s)
+{
+  struct timespec ts;
+  uint64 t0, t1;
+  int pid, st, tid, me = getpid();
+
+  t0 = nsnow();
+  t1 = nsnow();
+  if(t1 < t0){
+    printf("%s: time went backwards\n", s);
+    exit(1);
+  }
+
+  // less than a tick, then more than one.
+  ts.sec = 0;
+  ts.nsec = 5000000;
+  t0 = nsnow();
+  if(nanosleep(&ts) != 0 || nsnow() - t0 < 5000000){
+    printf("%s: short nanosleep of 5ms\n", s);
+    exit(1);
+  }
+  ts.nsec = 250000000;
+  t0 = nsnow();
+  if(nanosleep(&ts) != 0 || (t1 = nsnow() - t0) < 250000000 || t1 > 2*NSEC_PER_SEC){
+    printf("%s: nanosleep of 250ms took %dms\n", s, (int)(t1 / 1000000));
+    exit(1);
+  }
+  ts.nsec = NSEC_PER_SEC;
+  if(nanosleep(&ts) != -1){
+    printf("%s: nanosleep took a bad time\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid == 0)
+    exit(getpid() == me ? 0 : getpid() % 100);
+  wait(&st);
+  if(st != pid % 100){
+    printf("%s: child's getpid() wrong\n", s);
+    exit(1);
+  }
+
+  // threads share the page, so it can't say who's asking.
+  if((tid = uthread_create(tpidfn, 0)) < 0 || uthread_join(tid, 0) < 0){
+    printf("%s: uthread_create failed\n", s);
+    exit(1);
+  }
+  if(tpid != tid || getpid() != me){
+    printf("%s: getpid() wrong with threads\n", s);
+    exit(1);
+  }
+}
+
+// one write() of a whole, unaligned, maximum-size file,
+// which takes many log transactions.
+void
+writehuge(char *s)
+{
+  int fd, i, n = MAXFILE*BSIZE - 100;
+  char *p;
+
+  if((p = sbrk(n)) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++)
+    p[i] = i % 251;
+  unlink("huge");
+  fd = open("huge", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create huge failed\n", s);
+    exit(1);
+  }
+  if(write(fd, p, 100) != 100 || write(fd, p + 100, n - 100) != n - 100){
+    printf("%s: write huge failed\n", s);
+    exit(1);
+  }
+  memset(p, 0, n);
+  if(pread(fd, p, n, 0) != n){
+    printf("%s: read huge failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(p[i] != (char)(i % 251)){
+      printf("%s: wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("huge");
+  sbrk(-n);
+}
+
+// fsync() of files, which commits the log, and of
+// things that aren't files.
+void
+fsynctest(char *s)
+{
+  int fd, i, fds[2];
+  char buf[BSIZE];
+
+  unlink("fsyncf");
+  fd = open("fsyncf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create fsyncf failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 20; i++){
+    memset(buf, 'a' + i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write fsyncf failed\n", s);
+      exit(1);
+    }
+    if(i % 5 == 0 && fsync(fd) != 0){
+      printf("%s: fsync failed\n", s);
+      exit(1);
+    }
+  }
+  if(fsync(fd) != 0 || fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, sizeof(buf), 19*BSIZE) != sizeof(buf) || buf[0] != 'a' + 19){
+    printf("%s: wrong data after fsync\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("fsyncf");
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fsync(fds[0]) != -1 || fsync(fds[1] + 100) != -1){
+    printf("%s: fsync of a pipe or a bad fd worked\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// fill memory a page at a time, which forces pages out to
+// swap, and check that they all come back intact.
+void
+swapfill(char *s)
+{
+  char *base, *a;
+  int i, n, pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    base = sbrk(0);
+    for(n = 0; (a = sbrk(PGSIZE)) != (char*)0xffffffffffffffffL; n++)
+      *(int*)a = n;
+    if(n < 64){
+      printf("%s: only %d pages\n", s, n);
+      exit(1);
+    }
+    // memory and swap are both full now; free some of each.
+    n -= 64;
+    sbrk(-64*PGSIZE);
+    for(i = 0; i < n; i++){
+      if(*(int*)(base + i*PGSIZE) != i){
+        printf("%s: page %d has %d\n", s, i, *(int*)(base + i*PGSIZE));
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2665,12 +3822,30 @@ main(int argc, char *argv[])
     {subdir, "subdir"},
     {fourfiles, "fourfiles"},
     {sharedfd, "sharedfd"},
+    {sharedread, "sharedread"},
+    {manyfiles, "manyfiles"},
+    {mmapfile, "mmapfile"},
     {exectest, "exectest"},
+    {textbusy, "textbusy"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
     {sbrkbasic, "sbrkbasic"},
     {sbrkmuch, "sbrkmuch"},
+    {megapage, "megapage"},
+    {swapfill, "swapfill"},
+    {textwrite, "textwrite"},
+    {spawntest, "spawntest"},
+    {threads, "threads"},
+    {threadclose, "threadclose"},
+    {ulocks, "ulocks"},
+    {ringtest, "ringtest"},
+    {vecio, "vecio"},
+    {sendfiletest, "sendfiletest"},
+    {polltest, "polltest"},
+    {clocktest, "clocktest"},
+    {fsynctest, "fsynctest"},
+    {writehuge, "writehuge"},
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
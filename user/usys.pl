@@ -6,10 +6,13 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry(name, label) makes the stub under another name,
+# for calls that ulib.c wraps.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $label = shift || $name;
+    print ".global $label\n";
+    print "${label}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
@@ -32,7 +35,28 @@ entry("link");
 entry("mkdir");
 entry("chdir");
 entry("dup");
-entry("getpid");
+entry("getpid", "sys_getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("getprocinfo");
+entry("mmap");
+entry("munmap");
+entry("spawn");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("ring_setup");
+entry("ring_enter");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("sendfile");
+entry("splice");
+entry("fcntl");
+entry("poll");
+entry("clock_gettime", "sys_clock_gettime");
+entry("nanosleep");
+entry("fsync");
@@ -0,0 +1,92 @@
+// Threads, on top of clone() and join().
+//
+// Each thread runs on a stack of its own from malloc(), which
+// uthread_join() frees. Threads share all memory, so anything
+// they both write needs a lock or atomic operations
+// (e.g. __sync_fetch_and_add()).
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define STACKSIZE 8192
+#define NTHREAD 64
+
+struct uthread {
+  int tid;              // 0 if the slot is free
+  void (*fn)(void*);
+  void *arg;
+  char *stack;
+};
+
+static struct uthread threads[NTHREAD];
+static int lock;        // protects threads[].tid
+
+// Where a new thread starts, since clone() leaves
+// nowhere for fn to return to.
+static void
+start(void *a)
+{
+  struct uthread *t = a;
+
+  t->fn(t->arg);
+  exit(0);
+}
+
+// Start a thread running fn(arg). It ends when fn returns,
+// or calls exit(). Returns its id, or -1.
+int
+uthread_create(void (*fn)(void*), void *arg)
+{
+  struct uthread *t;
+  char *stack;
+  int tid;
+
+  if((stack = malloc(STACKSIZE)) == 0)
+    return -1;
+
+  while(__sync_lock_test_and_set(&lock, 1) != 0)
+    ;
+  for(t = threads; t < &threads[NTHREAD]; t++)
+    if(t->tid == 0)
+      break;
+  if(t < &threads[NTHREAD])
+    t->tid = -1;  // taken
+  __sync_lock_release(&lock);
+  if(t == &threads[NTHREAD]){
+    free(stack);
+    return -1;
+  }
+
+  t->fn = fn;
+  t->arg = arg;
+  t->stack = stack;
+  // stacks grow down from the 16-byte aligned top.
+  tid = clone(start, t, (void*)((uint64)(stack + STACKSIZE) & ~15L));
+  if(tid < 0){
+    free(stack);
+    t->tid = 0;
+    return -1;
+  }
+  t->tid = tid;
+  return tid;
+}
+
+// Wait for thread tid, made by the calling thread, to end,
+// and free its stack. Stores its exit status in *status if
+// status isn't 0. Returns 0, or -1 if there is no such thread.
+int
+uthread_join(int tid, int *status)
+{
+  struct uthread *t;
+
+  if(tid <= 0)
+    return -1;
+  for(t = threads; t < &threads[NTHREAD]; t++)
+    if(t->tid == tid)
+      break;
+  if(t == &threads[NTHREAD] || join(tid, status) < 0)
+    return -1;
+  free(t->stack);
+  t->tid = 0;
+  return 0;
+}
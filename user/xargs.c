@@ -57,15 +57,12 @@ int main(int argc,char *argv[])
         buf[index]='\0';
         params[argc-1]=buf;
         //memset(&buf,0,MAXLEN);  为什么这里加上这一句就不行了呢？
-        if(fork()==0)
+        if(spawn(cmd,params,0,0)<0)
         {
-            exec(cmd,params);
-            fprintf(2,"exec error");
+            fprintf(2,"exec error\n");
             exit(1);
         }
-        else{
-            wait(0);
-        }
+        wait(0);
     }
     return 0;
 